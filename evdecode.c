@@ -0,0 +1,120 @@
+/*
+ * evdecode.c - Render a binary event log from tsh (built w/ -DEVLOG) as
+ *    the text lines tsh -v prints
+ *
+ * usage: evdecode [-t] <log>
+ * With -t, each line starts w/ the secs since the first event.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "evlog.h"
+
+struct site_t { /* A call site, w/ its strings loaded */
+  unsigned line;
+  char *prefix, *file, *fmt;
+};
+
+char *readstr(FILE *f, size_t len);
+void render(struct site_t *site, struct evrec_t *rec);
+
+int main(int argc, char **argv) {
+  int stamps = argc == 3 && strcmp(argv[1], "-t") == 0;
+  struct evhdr_t hdr;
+  struct evrec_t rec;
+  uint64_t first = 0;
+  FILE *f;
+
+  if (argc != 2 + stamps) {
+    fprintf(stderr, "Usage: %s [-t] <log>\n", argv[0]);
+    exit(1);
+  }
+  if (!(f = fopen(argv[1 + stamps], "rb"))) {
+    perror(argv[1 + stamps]);
+    exit(1);
+  }
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      memcmp(hdr.magic, EVMAGIC, sizeof(hdr.magic)) != 0) {
+    fprintf(stderr, "%s: not a tsh event log\n", argv[1 + stamps]);
+    exit(1);
+  }
+
+  struct site_t *sites = calloc(hdr.nsites, sizeof(*sites));
+  for (uint32_t i = 0; i < hdr.nsites; i++) {
+    struct evsite_t s;
+    if (fread(&s, sizeof(s), 1, f) != 1 ||
+        !(sites[i].prefix = readstr(f, s.prefixlen)) ||
+        !(sites[i].file = readstr(f, s.filelen)) ||
+        !(sites[i].fmt = readstr(f, s.fmtlen))) {
+      fprintf(stderr, "%s: truncated call sites\n", argv[1 + stamps]);
+      exit(1);
+    }
+    sites[i].line = s.line;
+  }
+
+  for (uint32_t i = 0; i < hdr.nrecs && fread(&rec, sizeof(rec), 1, f); i++) {
+    if (rec.site >= hdr.nsites)
+      continue; // corrupt
+    if (!first)
+      first = rec.ns;
+    if (stamps)
+      printf("%12.6f ", (rec.ns - first) / 1e9);
+    render(&sites[rec.site], &rec);
+  }
+  fclose(f);
+  exit(0);
+}
+
+/* readstr - Read a string of len chars from f, or NULL at EOF */
+char *readstr(FILE *f, size_t len) {
+  char *s = malloc(len + 1);
+
+  if (!s || fread(s, 1, len, f) != len) {
+    free(s);
+    return NULL;
+  }
+  s[len] = '\0';
+  return s;
+}
+
+/*
+ * render - Print event rec from site as tsh's LOGWLOCF would have: its
+ *    format w/ each conversion filled from rec's args, in order
+ */
+void render(struct site_t *site, struct evrec_t *rec) {
+  int n = 0;
+
+  printf("[pid:%d] %s[%s:%u] ", rec->pid, site->prefix, site->file,
+         site->line);
+  for (const char *c = site->fmt; *c; c++) {
+    if (*c != '%' || c[1] == '%' || n >= EVARGS) {
+      putchar(*c == '%' && c[1] == '%' ? *c++ : *c);
+      continue;
+    }
+
+    char spec[16]; // the conversion, eg "%-5ld"
+    size_t len = 0;
+    int lng = 0;
+    spec[len++] = *c++;
+    while (*c && strchr("-+ #0123456789.", *c) && len < sizeof(spec) - 4)
+      spec[len++] = *c++;
+    for (; *c == 'l' || *c == 'z'; c++)
+      lng = 1;
+    if (!*c) // format ends mid conversion
+      break;
+    if (lng)
+      spec[len++] = 'l';
+    spec[len++] = *c;
+    spec[len] = '\0';
+
+    uint64_t arg = rec->args[n++];
+    if (*c == 's')
+      printf(spec, arg < EVSTR ? rec->str + arg : "?");
+    else if (lng)
+      printf(spec, (unsigned long)arg);
+    else
+      printf(spec, (unsigned)arg);
+  }
+  putchar('\n');
+}
@@ -0,0 +1,41 @@
+/*
+ * evlog.h - Binary event log format, shared by tsh (when built w/
+ *    -DEVLOG) & the evdecode tool that renders logs as text.
+ *
+ * A log file holds, in the host's byte order:
+ *    struct evhdr_t
+ *    nsites call sites, each a struct evsite_t & then its prefix, file &
+ *      format strings (w/o their null chars)
+ *    nrecs struct evrec_t events, oldest first
+ */
+#ifndef EVLOG_H
+#define EVLOG_H
+
+#include <stdint.h>
+
+#define EVMAGIC "TSHEVLG1" /* first 8 bytes of a log file */
+#define EVARGS 4           /* args kept per event */
+#define EVSTR 80           /* bytes kept of an event's string args */
+
+struct evhdr_t {   /* Log file header */
+  char magic[8];   /* EVMAGIC */
+  uint32_t nsites; /* call sites that follow */
+  uint32_t nrecs;  /* events that follow them */
+};
+
+struct evsite_t {    /* A log call site, as saved in a log file */
+  uint32_t line;     /* line number in file */
+  uint16_t prefixlen; /* length of its level prefix, eg "[INFO] " */
+  uint16_t filelen;  /* length of its file name */
+  uint16_t fmtlen;   /* length of its printf format */
+};
+
+struct evrec_t {         /* A logged event */
+  uint64_t ns;           /* CLOCK_MONOTONIC_RAW time it was logged */
+  uint32_t site;         /* index of its call site */
+  int32_t pid;           /* PID of the process that logged it */
+  uint64_t args[EVARGS]; /* its args, or for %s the offset in str */
+  char str[EVSTR];       /* its string args, null terminated, truncated */
+};
+
+#endif
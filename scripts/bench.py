@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+
+"""Startup latency benchmark for tsh's single command mode.
+
+Measures the time from exec'ing `tsh -c <cmd>` to tsh's first forked child
+starting, by having the child print the wall clock as its first action. The
+same child exec'd directly (no tsh) gives the baseline, so the difference
+between the two is tsh's own exec-to-first-fork overhead.
+
+Exits non-zero if the median overhead is over budget.
+"""
+
+import os
+import statistics
+import subprocess
+import sys
+import time
+
+TSH = "./tsh"
+STAMP = ["/bin/date", "+%s%N"]  # prints wall clock in ns as soon as it runs
+RUNS = 200
+BUDGET_NS = 1_000_000  # stay under 1ms of overhead
+
+
+def exec_to_start(argv: list[str]) -> int:
+    """Return ns between exec'ing argv & the stamp child starting."""
+    start = time.time_ns()
+    out = subprocess.run(argv, stdout=subprocess.PIPE, check=True).stdout
+    return int(out.decode().strip()) - start
+
+
+def sample(argv: list[str]) -> list[int]:
+    """Collect RUNS samples for argv after a few warmup runs."""
+    for _ in range(10):
+        exec_to_start(argv)
+    return [exec_to_start(argv) for _ in range(RUNS)]
+
+
+def report(name: str, samples: list[int]) -> None:
+    """Print summary stats for a set of samples, in microseconds."""
+    ordered = sorted(samples)
+    p95 = ordered[int(len(ordered) * 0.95)]
+    print(f"{name:>10}: median {statistics.median(ordered) / 1000:8.1f}us"
+          f"  p95 {p95 / 1000:8.1f}us  min {ordered[0] / 1000:8.1f}us")
+
+
+def main() -> int:
+    os.chdir(os.path.join(os.path.dirname(os.path.realpath(__file__)), ".."))
+
+    direct = sample(STAMP)
+    via_tsh = sample([TSH, "-c", " ".join(STAMP)])
+    report("direct", direct)
+    report("tsh -c", via_tsh)
+
+    overhead = statistics.median(via_tsh) - statistics.median(direct)
+    print(f"  overhead: {overhead / 1000:8.1f}us (budget {BUDGET_NS / 1000:.0f}us)")
+    return 0 if overhead <= BUDGET_NS else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
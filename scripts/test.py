@@ -3,11 +3,11 @@
 import asyncio
 import re
 import subprocess
-from typing import Generator, NewType, Optional, TypeGuard
+from typing import Generator, NewType, Optional, TypeAlias, TypeGuard
 from unittest import main, IsolatedAsyncioTestCase
 
-type Match = tuple[re.Match[str], re.Match[str]] # shorthand for tuple of match groups
-type MaybeMatchGen = Generator[tuple[Optional[re.Match[str]], Optional[re.Match[str]]], None, None]
+Match: TypeAlias = tuple[re.Match[str], re.Match[str]] # shorthand for tuple of match groups
+MaybeMatchGen: TypeAlias = Generator[tuple[Optional[re.Match[str]], Optional[re.Match[str]]], None, None]
 
 
 class Tests(IsolatedAsyncioTestCase):
@@ -25,6 +25,17 @@ class Tests(IsolatedAsyncioTestCase):
     _jbrx = re.compile(r"^((?:Job )?\[[0-9]+\]) \([0-9]{1,10}\)(.*)$")
     rgxs = [_psrx, _jbrx]
 
+    # masks for values that differ between runs, in traces compared to
+    # saved output (timings & the like)
+    masks = [
+        (re.compile(r" *\b[0-9]+(?:\.[0-9]+)?(?:us|ms|s)\b"), " <time>"),
+        (re.compile(r"[0-9]+ of [0-9]+ bytes used"), "<n> of <max> bytes used"),
+        (re.compile(r"[0-9]+ items/s"), "<rate> items/s"),
+        (re.compile(r"maxrss [0-9]+k  csw [0-9]+\+[0-9]+"), "maxrss <rss>  csw <csw>"),
+        (re.compile(r"[0-9]{4}-[0-9]{2}-[0-9]{2} [0-9:]{8}\.[0-9]{3}"), "<date>"),
+        (re.compile(r"outliers [0-9]+ \([0-9.]+%\)"), "outliers <n>"),
+    ]
+
     @classmethod
     def get_cmd(cls, number: int, impl: str) -> str:
         """Build sdriver command string for given trace number & tiny shell implementation path."""
@@ -73,6 +84,20 @@ class Tests(IsolatedAsyncioTestCase):
 
         return await asyncio.gather(act, exp)
 
+    @classmethod
+    def mask(cls, output: str) -> str:
+        """Replace values in output that differ between runs w/ placeholders."""
+        for rx, repl in cls.masks:
+            output = rx.sub(repl, output)
+        return output
+
+    async def check_golden(self, number: int) -> None:
+        """Run test using own shell & compare to its saved output, trace<number>.out."""
+        act = await self.run_test(number, self.itsh)
+        with open(f"trace{number:02d}.out") as f:
+            exp = f.read()
+        self.assertMultilineEqualExceptPid(self.mask(act), self.mask(exp))
+
     def assertMultilineEqualExceptPid(self, actual: str, expected: str, msg: str = "") -> None:
         """Assert two multiline strings are equal, except for known locations of PID values."""
         act_lines = actual.split("\n")
@@ -211,6 +236,66 @@ class Tests(IsolatedAsyncioTestCase):
         act, exp = await self.exec(16)
         self.assertMultilineEqualExceptPid(act, exp)
 
+    async def test_trace17(self) -> None:
+        await self.check_golden(17)
+
+    async def test_trace18(self) -> None:
+        await self.check_golden(18)
+
+    async def test_trace19(self) -> None:
+        await self.check_golden(19)
+
+    async def test_trace20(self) -> None:
+        await self.check_golden(20)
+
+    async def test_trace21(self) -> None:
+        await self.check_golden(21)
+
+    async def test_trace22(self) -> None:
+        await self.check_golden(22)
+
+    async def test_trace23(self) -> None:
+        await self.check_golden(23)
+
+    async def test_trace24(self) -> None:
+        await self.check_golden(24)
+
+    async def test_trace25(self) -> None:
+        await self.check_golden(25)
+
+    async def test_trace26(self) -> None:
+        await self.check_golden(26)
+
+    async def test_trace27(self) -> None:
+        await self.check_golden(27)
+
+    async def test_trace28(self) -> None:
+        await self.check_golden(28)
+
+    async def test_trace29(self) -> None:
+        await self.check_golden(29)
+
+    async def test_trace30(self) -> None:
+        await self.check_golden(30)
+
+    async def test_trace31(self) -> None:
+        await self.check_golden(31)
+
+    async def test_trace32(self) -> None:
+        await self.check_golden(32)
+
+    async def test_trace33(self) -> None:
+        await self.check_golden(33)
+
+    async def test_trace34(self) -> None:
+        await self.check_golden(34)
+
+    async def test_trace35(self) -> None:
+        await self.check_golden(35)
+
+    async def test_trace36(self) -> None:
+        await self.check_golden(36)
+
 
 if __name__ == "__main__":
     main()
@@ -5,33 +5,138 @@
  * emails = achangdewitt@hawk.iit.edu
  * github = andrew-chang-dewitt
  */
+#define _GNU_SOURCE /* for memfd_create */
 #include <ctype.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <math.h>
 #include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "evlog.h"
+
 /* Misc manifest constants */
 #define MAXLINE 1024   /* max line size */
 #define MAXARGS 128    /* max args on a command line */
-#define MAXJOBS 16     /* max jobs at any point in time */
+#define MAXARGBUF (8 * MAXLINE) /* max size of args, after glob expansion */
+#define MAXJOBS 1024   /* max jobs at any point in time, including queued */
 #define MAXJID 1 << 16 /* max job ID */
+#define MINVARS 64     /* initial size of the shell variable table */
+#define MAXDEPS 16     /* max jobs an after command can wait on */
+#define MAXBACKOFF 60  /* max seconds between retries or restarts */
+#define CRASHSECS 10   /* supervised jobs exiting sooner than this crashed */
+#define MAXCRASHES 5   /* default restarts of a crash looping job */
+#define MAXDONE 64     /* exit statuses of finished jobs kept for wait */
+#define CACHESIZE (64 << 20) /* default max bytes of cached results */
+#define MAXTAGS 128    /* max length of a job's tags */
+#define NAMEBUCKETS 256  /* buckets in the job name index */
+#define GRAMBUCKETS 1024 /* buckets in the job command line trigram index */
+#define MAXDIRCACHE 8  /* max directory listings cached for globbing */
+#define DENTBUF 65536  /* size of getdents64 batches */
+
+/* Command list operators, joining a command to the next one */
+#define OP_END 0 /* end of list */
+#define OP_SEQ 1 /* ';' or '&', always run next command */
+#define OP_AND 2 /* '&&', run next command iff this one succeeded */
+#define OP_OR 3  /* '||', run next command iff this one failed */
+
+/* Command list node types */
+#define N_CMD 0   /* simple command */
+#define N_FOR 1   /* for loop */
+#define N_WHILE 2 /* while loop */
 
 /* Job states */
 #define UNDEF 0 /* undefined */
 #define FG 1    /* running in foreground */
 #define BG 2    /* running in background */
 #define ST 3    /* stopped */
+#define QU 4    /* queued, waiting for a free job slot */
+#define BL 5    /* blocked, waiting for other jobs to exit */
+#define RS 6    /* supervised & exited, waiting to be restarted */
+
+/* Job spec types, see selectjobs */
+#define JS_JID 0  /* %N or a range %N-%M */
+#define JS_PID 1  /* N */
+#define JS_CUR 2  /* %+ or %%, the current job */
+#define JS_PREV 3 /* %-, the previous job */
+#define JS_SUB 4  /* %?str, jobs w/ str in their command line */
+#define JS_TAG 5  /* @tag, jobs tagged w/ tag */
+#define JS_NAME 6 /* %name, jobs running a program named name */
+
+/* Manifest entry states */
+#define M_NEW 0   /* not launched yet */
+#define M_RUN 1   /* running as a job */
+#define M_RETRY 2 /* failed, waiting to be retried */
+#define M_DONE 3  /* finished, reported */
+
+/* Latency histograms, see stats */
+#define H_PARSE 0   /* eval: expanding & parsing a line */
+#define H_LOOKUP 1  /* runcmd: builtin lookup of a non-builtin */
+#define H_FORK 2    /* fork() in tsh */
+#define H_EXEC 3    /* fork() in tsh to execve() in the child */
+#define H_WAKEUP 4  /* fg job leaving the fg to waitfg waking */
+#define H_REAP 5    /* sigchld_handler run */
+#define H_BATCH 6   /* children reaped per sigchld_handler run, a count */
+#define H_FORWARD 7 /* ctrl-c or ctrl-z forwarded to the fg job */
+#define NHISTS 8
+#define HISTSUB 4 /* log2 of the linear sub-buckets per power of 2 */
+#define HISTBUCKETS ((64 - HISTSUB + 1) << HISTSUB)
+
+/* Command phases, timed in verbose mode, see phase */
+#define P_READ 0    /* reading the line */
+#define P_PARSE 1   /* expanding & parsing it */
+#define P_BUILTIN 2 /* builtin_cmd, running the builtin if it is one */
+#define P_BLOCK 3   /* blocking SIGCHLD */
+#define P_FORK 4    /* fork() */
+#define P_ADDJOB 5  /* addjob() */
+#define P_WAITFG 6  /* waitfg(), the job's run */
+#define P_REAP 7    /* sigchld_handler run that reaped the fg job */
+#define NPHASES 8
+
+/* Job set helpers, for struct jobset_t */
+#define JOBSET_BITS (8 * sizeof(unsigned long))
+#define JOBSET_HAS(set, i)                                                     \
+  ((set)->bits[(i) / JOBSET_BITS] >> ((i) % JOBSET_BITS) & 1)
+#define JOBSET_ADD(set, i)                                                     \
+  ((set)->bits[(i) / JOBSET_BITS] |= 1UL << ((i) % JOBSET_BITS))
+#define JOBSET_DEL(set, i)                                                     \
+  ((set)->bits[(i) / JOBSET_BITS] &= ~(1UL << ((i) % JOBSET_BITS)))
 
 /* Logger helpers */
 #define PREF_ERR "[ERROR] "
 #define PREF_WARN "[WARN] "
 #define PREF_INFO "[INFO] "
 
+#ifdef EVLOG
+/* Log calls record binary events instead, always, see evlog */
+#define EVRING 4096 /* events kept, a power of 2 */
+#define EVSITE(prefix, fmt)                                                    \
+  ({                                                                           \
+    static struct evsite_def_t site                                            \
+        __attribute__((section("evlog_sites"), used)) = {prefix, __FILE__,    \
+                                                         fmt, __LINE__};      \
+    &site;                                                                     \
+  })
+#define LOGWLOC(stream, prefix, msg) evlog(EVSITE(prefix, msg))
+#define LOGWLOCF(stream, prefix, fmt, ...)                                     \
+  evlog(EVSITE(prefix, fmt), __VA_ARGS__)
+#define LOGIF(cond) /* events are cheap enough to always record */
+#else
 #define LOGWLOC(stream, prefix, msg)                                           \
   {                                                                            \
     fprintf(stream, "[pid:%d] %s[%s:%d] %s\n", getpid(), prefix, __FILE__,     \
@@ -40,34 +145,73 @@
 
 #define LOGWLOCF(stream, prefix, fmt, ...)                                     \
   {                                                                            \
-    char loc[] = "[%s:%d] ";                                                   \
-    char *res;                                                                 \
-    if (asprintf(&res, "[pid:%d] %s%s%s\n", getpid(), prefix, loc, fmt) < 0)   \
-      fprintf(stream, fmt, __VA_ARGS__);                                       \
-    else                                                                       \
-      fprintf(stream, res, __FILE__, __LINE__, __VA_ARGS__);                   \
-    free(res);                                                                 \
+    fprintf(stream, "[pid:%d] %s[%s:%d] " fmt "\n", getpid(), prefix,          \
+            __FILE__, __LINE__, __VA_ARGS__);                                  \
   }
+#define LOGIF(cond) if (cond)
+#endif
 
 #define LOGERR(msg)                                                            \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOC(stderr, PREF_ERR, msg)
 #define FLOGERR(fmt, ...)                                                      \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOCF(stderr, PREF_ERR, fmt, __VA_ARGS__)
 #define LOGWARN(msg)                                                           \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOC(stdout, PREF_WARN, msg)
 #define FLOGWARN(fmt, ...)                                                     \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOCF(stdout, PREF_WARN, fmt, __VA_ARGS__)
 #define LOGINFO(msg)                                                           \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOC(stdout, PREF_INFO, msg)
 #define FLOGINFO(fmt, ...)                                                     \
-  if (verbose)                                                                 \
+  LOGIF(verbose)                                                               \
   LOGWLOCF(stdout, PREF_INFO, fmt, __VA_ARGS__)
 
+/*
+ * USDT probes, for perf & bpftrace, eg
+ *    bpftrace -e 'usdt:./tsh:tsh:job_add { printf("%d %s", arg0, str(arg2)); }'
+ * Each probe is a nop, plus an ELF note (as <sys/sdt.h> would emit) that
+ * tells tracers where the nop is & where its args are, so probes cost
+ * nothing until attached. All args are passed as longs.
+ */
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+#define USDT(name, args, ...)                                                  \
+  __asm__ __volatile__(                                                        \
+      "990: nop\n"                                                             \
+      ".pushsection .note.stapsdt,\"?\",\"note\"\n"                             \
+      ".balign 4\n"                                                            \
+      ".4byte 992f-991f, 994f-993f, 3\n"                                       \
+      "991: .asciz \"stapsdt\"\n"                                              \
+      "992: .balign 4\n"                                                       \
+      "993: .8byte 990b\n"                                                     \
+      ".8byte _.stapsdt.base\n"                                                \
+      ".8byte 0\n" /* no semaphore */                                          \
+      ".asciz \"tsh\"\n"                                                       \
+      ".asciz \"" #name "\"\n"                                                 \
+      ".asciz \"" args "\"\n"                                                  \
+      "994: .balign 4\n"                                                       \
+      ".popsection\n"                                                          \
+      ".ifndef _.stapsdt.base\n"                                               \
+      ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n"  \
+      ".weak _.stapsdt.base\n"                                                 \
+      ".hidden _.stapsdt.base\n"                                               \
+      "_.stapsdt.base: .space 1\n"                                             \
+      ".size _.stapsdt.base, 1\n"                                              \
+      ".popsection\n"                                                          \
+      ".endif\n" ::__VA_ARGS__)
+#else
+#define USDT(name, args, ...)
+#endif
+#define PROBE1(name, a) USDT(name, "-8@%0", "nor"((long)(a)))
+#define PROBE2(name, a, b)                                                     \
+  USDT(name, "-8@%0 -8@%1", "nor"((long)(a)), "nor"((long)(b)))
+#define PROBE3(name, a, b, c)                                                  \
+  USDT(name, "-8@%0 -8@%1 -8@%2", "nor"((long)(a)), "nor"((long)(b)),          \
+       "nor"((long)(c)))
+
 /*
  * Jobs states: FG (foreground), BG (background), ST (stopped)
  * Job state transitions and enabling actions:
@@ -75,7 +219,16 @@
  *     ST -> FG  : fg command
  *     ST -> BG  : bg command
  *     BG -> FG  : fg command
- * At most 1 job can be in the FG state.
+ *     QU -> BG  : job slot freed, or bg command
+ *     QU -> FG  : fg command
+ *     BL -> QU  : all jobs it waits on exited
+ *     BL -> BG  : bg command
+ *     BL -> FG  : fg command
+ *     FG -> RS  : supervised job exited
+ *     BG -> RS  : supervised job exited
+ *     RS -> QU  : restart backoff elapsed
+ * At most 1 job can be in the FG state, & at most jobslots jobs can be in
+ * the FG or BG states; more bg jobs wait in the QU state, with no PID yet.
  */
 
 /* Global variables */
@@ -83,43 +236,377 @@ extern char **environ;   /* defined in libc */
 char prompt[] = "tsh> "; /* command line prompt (DO NOT CHANGE) */
 int verbose = 0;         /* if true, print additional output */
 int nextjid = 1;         /* next job ID to allocate */
+int last_status = 0;     /* exit status of the last command run */
+int fg_status = 0;       /* status of the fg job, set when it stops/exits */
+int interrupted = 0;     /* set when ctrl-c kills a fg job, to end the line */
+int idle = 0;    /* if true, tsh is blocked waiting, see setidle */
+int pumpdue = 0; /* if true, sigchld_handler left launches to pumpjobs */
 char sbuf[MAXLINE];      /* for composing sprintf messages */
 
+int interactive = 0;         /* if true, tsh owns a tty & hands it to fg jobs */
+pid_t shell_pgid;            /* tsh's own process group */
+struct termios shell_tmodes; /* tty modes to restore when tsh takes tty back */
+
 struct job_t {           /* The job struct */
-  pid_t pid;             /* job PID */
+  pid_t pid;             /* job PID, 0 while queued */
   int jid;               /* job ID [1, 2, ...] */
-  int state;             /* UNDEF, BG, FG, or ST */
+  int state;             /* UNDEF, BG, FG, ST or QU */
   char cmdline[MAXLINE]; /* command line */
+  unsigned long seq;     /* unique job number, also the FIFO queue order */
+  int tagged;            /* if true, prefix output lines w/ the last arg */
+  int deps[MAXDEPS];     /* jids of jobs a blocked job waits on */
+  int ndeps;             /* number of jobs in deps */
+  int needok;            /* if true, cancel job if a job in deps fails */
+  int mentry;            /* 1 + index of its manifest entry, 0 if none */
+  struct timespec started; /* when it was last launched */
+  int supervised;        /* if true, restart job when it exits */
+  int maxcrashes;        /* give up after this many crashes in a row */
+  int crashes;           /* crashes in a row, see CRASHSECS */
+  int restarts;          /* times restarted so far */
+  struct timespec due;   /* when to restart, in the RS state */
+  struct timespec queued; /* when it was queued */
+  int deferred;          /* if true, queued by the launch rate limit */
+  unsigned long touched; /* jobclock when last started, stopped or moved */
+  int wstatus;           /* wait status it last stopped with, in ST */
+  char tags[MAXTAGS];    /* space separated tags, see tag */
+  int nassign;           /* number of NAME=value assigns in args */
+  int nargs;             /* number of assigns & args in args */
+  char args[MAXLINE];    /* assigns then args, null separated */
+  int argslen;           /* size of args, -1 if they didn't fit */
+  unsigned long key;     /* hash of args, cwd & env, for dedup */
 };
 struct job_t jobs[MAXJOBS]; /* The job list */
+unsigned long jobclock = 0; /* ticks as jobs are touched, for %+ & %- */
+
+struct jobset_t { /* A set of jobs, by index in the job list */
+  unsigned long bits[MAXJOBS / JOBSET_BITS];
+};
+
+struct jobindex_t { /* Indexes of the job list, see indexjob */
+  struct jobset_t names[NAMEBUCKETS]; /* by hash of argv[0]'s basename */
+  struct jobset_t grams[GRAMBUCKETS]; /* by hash of each cmdline trigram */
+} jobindex;
+
+struct jobspec_t { /* A parsed job spec, see selectjobs */
+  int type;        /* JS_JID, JS_PID, JS_CUR, JS_PREV, JS_SUB, JS_TAG... */
+  long lo, hi;     /* jid range, or pid in lo */
+  const char *str; /* substring, tag or name */
+  const char *text; /* the spec as given, for errors */
+  int hits;        /* jobs matched */
+  struct jobset_t cand; /* for JS_SUB & JS_NAME, jobs that may match */
+};
+
+struct ratelimit_t {      /* Token bucket limiting bg job launches */
+  double rate;            /* tokens added per sec, 0 for no limit */
+  double burst;           /* max tokens held */
+  double tokens;          /* tokens held now */
+  struct timespec last;   /* when tokens was last topped up */
+  unsigned long deferred; /* launches deferred for lack of a token */
+  unsigned long launched; /* deferred launches since launched */
+  double waited;          /* secs those launches waited in total */
+};
+struct ratelimit_t ratelimit; /* The launch rate limit, see launchrate */
+int jobslots = MAXJOBS;     /* max jobs running at once, see -j */
+unsigned long nextseq = 0;  /* next job seq to allocate */
+
+struct hist_t {         /* A log-linear histogram of ns (or counts) */
+  unsigned long count;  /* values recorded */
+  unsigned long sum;    /* their total, for the mean */
+  unsigned long buckets[HISTBUCKETS]; /* values recorded, see histindex */
+};
+struct hist_t *hists = NULL; /* NHISTS histograms, see initstats */
+unsigned long forkat = 0;    /* when tsh last forked a job, in ns */
+unsigned long fgleftat = 0;  /* when the fg job last left the fg, in ns */
+
+#ifdef EVLOG
+struct evsite_def_t { /* A log call site, in the evlog_sites section */
+  const char *prefix; /* level prefix, eg PREF_INFO */
+  const char *file;   /* file name */
+  const char *fmt;    /* printf format */
+  long line;          /* line number */
+};
+extern struct evsite_def_t __start_evlog_sites[], __stop_evlog_sites[];
+
+struct evring_t {               /* This process's event log */
+  unsigned long next;           /* events ever logged */
+  struct evrec_t recs[EVRING];  /* the latest of them */
+} evring;
+pid_t evowner = 0; /* process that writes the log out at exit */
+#endif
+
+struct phases_t {            /* Phase times of the current command */
+  unsigned long ns[NPHASES]; /* ns spent in each phase */
+  unsigned set;              /* bit for each phase timed */
+} phases;
+
+struct done_t {       /* A finished job, for wait & jobs -l/-c */
+  unsigned long seq;  /* the job's seq */
+  int status;         /* its exit status */
+  int wstatus;        /* its wait status, for how it ended */
+  int jid;            /* its JID */
+  pid_t pid;          /* its PID, 0 if it never ran */
+  double wall;        /* secs from launch to exit */
+  struct timespec ended; /* wall clock time it exited */
+  struct rusage ru;   /* resources it used */
+  char cmdline[MAXLINE]; /* its command line */
+};
+struct done_t donejobs[MAXDONE]; /* ring of the latest finished jobs */
+unsigned long ndonejobs = 0;     /* jobs ever added to donejobs */
+unsigned long listeddone = 0;    /* ndonejobs at the last jobs -l */
+
+struct dedup_t {        /* Singleflight dedup of bg jobs, see dedup */
+  int on;               /* if true, attach to identical running jobs */
+  unsigned long saved;  /* forks saved by attaching */
+  unsigned long envgen; /* bumped whenever the exported env changes */
+};
+struct dedup_t dedup;
+
+struct cache_t {           /* Result cache for the cached prefix */
+  char dir[MAXLINE];       /* cache directory, "" until first used */
+  long long max;           /* max bytes of results kept */
+  long long bytes;         /* bytes of results kept, -1 until counted */
+  unsigned long hits;      /* runs replayed from the cache */
+  unsigned long misses;    /* runs not found in the cache */
+  unsigned long evictions; /* results evicted to stay under max */
+};
+struct cache_t cache = {.bytes = -1};
+
+struct cachefile_t {     /* A cache file, as listed by cacheevict */
+  char name[256];        /* file name in the cache directory */
+  struct timespec mtime; /* when last used */
+  off_t size;            /* size in bytes */
+};
+
+struct parallel_t { /* A running parallel builtin */
+  int nslots;       /* max jobs running at once */
+  int running;      /* jobs running now */
+  pid_t *pids;      /* pid of the job in each slot, 0 if free */
+  int *inputs;      /* index of the input run by the job in each slot */
+  int *status;      /* exit status of each input's job */
+};
+struct parallel_t *parallel = NULL; /* the running parallel, if any */
+
+struct mentry_t {         /* A manifest entry, see -m */
+  char *cmdline;          /* command line, as shown by jobs */
+  char *args;             /* assigns then args, null separated */
+  size_t argslen;         /* size of args */
+  int nassign;            /* number of NAME=value assigns in args */
+  int nargs;              /* number of assigns & args in args */
+  int line;               /* line number in the manifest */
+  int state;              /* M_NEW, M_RUN, M_RETRY or M_DONE */
+  int attempts;           /* times launched so far */
+  struct timespec start;  /* when last launched */
+  struct timespec due;    /* when to retry, in M_RETRY */
+  double wall;            /* wall time of the last attempt, in secs */
+  int wstatus;            /* wait status of the last attempt */
+  struct rusage ru;       /* resources used by the last attempt */
+};
+struct manifest_t {       /* The manifest being run, see -m */
+  struct mentry_t *entries;
+  int count;              /* number of entries, 0 if no manifest */
+  int next;               /* first entry in the M_NEW state */
+  int nretry;             /* entries in the M_RETRY state */
+  int ndone;              /* entries in the M_DONE state */
+  int nfailed;            /* M_DONE entries whose last attempt failed */
+  int retries;            /* times to retry a failed entry, see -r */
+  int fd;                 /* report file */
+};
+struct manifest_t manifest = {.retries = 2};
+
+struct var_t {  /* A shell variable */
+  char *kv;     /* "NAME=value", as handed to exec in envp */
+  size_t nlen;  /* length of NAME */
+  int exported; /* if true, var is passed to jobs' environments */
+  size_t envi;  /* index of kv in envp, if exported & envp is current */
+};
+struct var_t *vars = NULL; /* open addressing table of shell variables */
+size_t varcap = 0;         /* number of slots in vars, a power of 2 */
+size_t varcnt = 0;         /* number of slots in use, including deleted */
+char **envp = NULL;        /* cached environment for exec, see getenvp */
+size_t envlen = 0;         /* entries in envp, w/ MAXARGS free slots after */
+int envdirty = 1;          /* if true, envp must be rebuilt before use */
+
+struct dircache_t {       /* A cached directory listing, for globbing */
+  char path[MAXLINE];     /* directory path, "" if slot is unused */
+  dev_t dev;              /* device, inode & mtime of the directory when */
+  ino_t ino;              /*   it was read, to validate the listing */
+  struct timespec mtime;
+  char *names;            /* null separated names of entries */
+  int count;              /* number of names */
+  unsigned long lastused; /* for evicting the least recently used */
+};
+struct dircache_t dircache[MAXDIRCACHE]; /* directory listing cache */
+unsigned long dirclock = 0;              /* ticks on each cache lookup */
+
+struct node_t {        /* A parsed command list entry */
+  int type;            /* N_CMD, N_FOR or N_WHILE */
+  int op;              /* operator joining this node to the next */
+  char *text;          /* N_CMD: command text, N_FOR: loop variable */
+  char *words;         /* N_FOR: words to loop over, before expansion */
+  struct node_t *cond; /* N_WHILE: condition list */
+  struct node_t *body; /* N_FOR/N_WHILE: loop body list */
+  struct node_t *next; /* next node in the list */
+};
 /* End global variables */
 
 /* Function prototypes */
 
 /* Here are the functions that you will implement */
-void eval(char *cmdline);
+int eval(char *cmdline);
+int runcmd(char *expanded, int argc, char **argv, char **assigns, int nassign,
+           char **env, int bg);
+int spawncmd(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env, int bg);
+int evallist(const char *cmdline);
+int execlist(struct node_t *node);
+void execcmd(const char *text);
+void execfor(struct node_t *node);
+void execwhile(struct node_t *node);
+int parselist(const char **sp, struct node_t **list);
+int parseloop(const char **sp, struct node_t *node);
+int keyword(const char *s, const char *kw);
+void freelist(struct node_t *node);
+const char *nextcmd(const char *cmdline, int *op, const char **next);
+int expand(const char *cmdline, char *dest);
+int cmdsubst(const char *cmds, char *dest, size_t size);
+const char *matchparen(const char *s);
 int builtin_cmd(int argc, char **argv);
 void do_bgfg(int argc, char **argv);
-void waitfg(pid_t pid);
+void do_echo(int argc, char **argv);
+void do_printf(int argc, char **argv);
+void do_export(int argc, char **argv);
+void do_jobslots(int argc, char **argv);
+void do_parallel(int argc, char **argv);
+void do_after(int argc, char **argv);
+void do_supervise(int argc, char **argv);
+void do_launchrate(int argc, char **argv);
+void do_dedup(int argc, char **argv);
+void do_wait(int argc, char **argv);
+void do_batch(int argc, char **argv);
+void do_kill(int argc, char **argv);
+void do_jobs(int argc, char **argv);
+void printusage(double wall, struct rusage *ru);
+void listdone(void);
+int procusage(pid_t pid, struct rusage *ru);
+void do_tag(int argc, char **argv);
+int signum(const char *name);
+char **readlines(FILE *f, int *n);
+int waitfg(pid_t pid);
+void initterm(int block);
+void giveterm(pid_t pgid);
 
 void sigchld_handler(int sig);
 void sigtstp_handler(int sig);
 void sigint_handler(int sig);
 
 /* Here are helper routines that we've provided for you */
-int parseline(const char *cmdline, int *argc_dest, char **argv);
+int parseline(const char *cmdline, int *argc_dest, char **argv, char *buf,
+              size_t size);
 void sigquit_handler(int sig);
 
 void initjobs(struct job_t *jobs);
 void clearjob(struct job_t *job);
 void listjobs(struct job_t *jobs);
+void printjob(struct job_t *job);
+int selectjobs(const char *cmd, int nspecs, char **specs, struct job_t **sel);
+int parsespec(const char *cmd, char *text, struct jobspec_t *spec);
+int matchspec(struct jobspec_t *spec, struct job_t *job);
+int hastag(struct job_t *job, const char *tag, size_t len);
+void indexjob(struct job_t *job, int add);
+size_t jobname(const char *cmdline, const char **name);
+unsigned namehash(const char *name, size_t len);
+unsigned gramhash(const char *gram);
 int maxjid(struct job_t *jobs);
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline);
+struct job_t *addjob(struct job_t *jobs, pid_t pid, int state,
+                     char *cmdline);
 int deletejob(struct job_t *jobs, pid_t pid);
 pid_t fgpid(struct job_t *jobs);
 struct job_t *getjobpid(struct job_t *jobs, pid_t pid);
 struct job_t *getjobjid(struct job_t *jobs, int jid);
 int pid2jid(pid_t pid);
+int runningjobs(void);
+int queuedjobs(void);
+struct job_t *queuejob(char *cmdline, char **assigns, int nassign,
+                       char **argv, int argc);
+int startjob(struct job_t *job, int state);
+void launchqueued(void);
+void pumpjobs(void);
+void setidle(int on);
+void idlewait(const sigset_t *mask);
+void execjob(char **argv, char **env, char **assigns, int nassign, int fg,
+             const char *tag);
+void tagoutput(const char *tag);
+void jobexited(struct job_t *job, int wstatus, struct rusage *ru);
+int exitcode(int wstatus);
+int restartjob(struct job_t *job, int wstatus);
+void pumprestarts(void);
+void armtimer(double secs);
+int taketoken(void);
+double tokenwait(void);
+int packargs(char *dest, char **assigns, int nassign, char **argv, int argc);
+unsigned long jobkey(const char *args, int len);
+struct job_t *findtwin(unsigned long key, const char *args, int len);
+int donestatus(unsigned long seq);
+
+void initvars(void);
+size_t varhash(const char *name, size_t nlen);
+struct var_t *findslot(const char *name, size_t nlen);
+struct var_t *findvar(const char *name, size_t nlen);
+char *getvar(const char *name, size_t nlen);
+int setvar(const char *name, size_t nlen, const char *value, int exported);
+void unsetvar(const char *name);
+char **getenvp(void);
+char **overlayenv(char **env, char **assigns, int n);
+int isassign(const char *word);
+
+int globargs(int *argc, char **argv, const int *quoted, char *pool,
+             size_t size);
+int globword(char *pattern, char **dest, int max, char **pool, size_t *size);
+struct dircache_t *readdircached(const char *path);
+
+void loadmanifest(const char *path, const char *report);
+void pumpmanifest(void);
+int launchentry(struct mentry_t *e, struct timespec *now);
+void finishentry(struct mentry_t *e, int wstatus, struct rusage *ru);
+void waitmanifest(void);
+size_t jsonstr(char *dest, size_t size, const char *s);
+
+int runcached(char *expanded, int argc, char **argv, char **assigns,
+              int nassign, char **env);
+int cachekey(char *dest, size_t size, int argc, char **argv, char **assigns,
+             int nassign, char **env);
+const char *cachedir(void);
+int cachereplay(const char *path, const char *key, size_t keylen);
+void cachestore(const char *path, const char *key, size_t keylen, int status,
+                int outfd, int errfd);
+void copyfd(int fd, int to);
+void cacheevict(void);
+int cmpmtime(const void *a, const void *b);
+void cachestats(void);
+
+int runtimed(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env);
+int runbench(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env);
+void cputimes(double *user, double *sys);
+char *fmtsecs(double secs, char *buf);
+
+void initstats(void);
+unsigned long nowns(void);
+void histadd(int h, unsigned long v);
+unsigned histindex(unsigned long v);
+unsigned long histvalue(unsigned idx);
+unsigned long histpct(struct hist_t *hist, double pct);
+void do_stats(int argc, char **argv);
+void phase(int p, unsigned long t0);
+void printphases(const char *cmd);
+
+#ifdef EVLOG
+void evlog(const struct evsite_def_t *site, ...);
+void evdump(void);
+#endif
+int cmpdouble(const void *a, const void *b);
+void sigalrm_handler(int sig);
 
 void usage(void);
 void unix_error(char *msg);
@@ -134,13 +621,12 @@ int main(int argc, char **argv) {
   char c;
   char cmdline[MAXLINE];
   int emit_prompt = 1; /* emit prompt (default) */
-
-  /* Redirect stderr to stdout (so that driver will get all output
-   * on the pipe connected to stdout) */
-  dup2(1, 2);
+  char *command = NULL; /* command list to run with -c, if any */
+  char *mpath = NULL;   /* manifest to run with -m, if any */
+  char *report = NULL;  /* report file for -m, if not the default */
 
   /* Parse the command line */
-  while ((c = getopt(argc, argv, "hvp")) != EOF) {
+  while ((c = getopt(argc, argv, "hvpc:j:m:r:o:")) != EOF) {
     switch (c) {
     case 'h': /* print help message */
       usage();
@@ -151,11 +637,36 @@ int main(int argc, char **argv) {
     case 'p':          /* don't print a prompt */
       emit_prompt = 0; /* handy for automatic testing */
       break;
+    case 'c': /* run a single command list & exit with its status */
+      command = optarg;
+      break;
+    case 'j': /* limit number of jobs running at once */
+      jobslots = atoi(optarg);
+      if (jobslots < 1 || jobslots > MAXJOBS)
+        usage();
+      break;
+    case 'm': /* run a manifest of commands as bg jobs */
+      mpath = optarg;
+      break;
+    case 'r': /* times to retry failed manifest entries */
+      manifest.retries = atoi(optarg);
+      if (manifest.retries < 0)
+        usage();
+      break;
+    case 'o': /* write the manifest report here */
+      report = optarg;
+      break;
     default:
       usage();
     }
   }
 
+  /* Redirect stderr to stdout (so that driver will get all output
+   * on the pipe connected to stdout), except when used as a one-shot
+   * command wrapper where the caller expects stderr untouched */
+  if (!command)
+    dup2(1, 2);
+
   /* Install the signal handlers */
 
   /* These are the ones you will need to implement */
@@ -166,8 +677,34 @@ int main(int argc, char **argv) {
   /* This one provides a clean way to kill the shell */
   Signal(SIGQUIT, sigquit_handler);
 
-  /* Initialize the job list */
-  initjobs(jobs);
+  /* Retry timer for the manifest runner */
+  Signal(SIGALRM, sigalrm_handler);
+
+  initstats();
+#ifdef EVLOG
+  evowner = getpid();
+  atexit(evdump);
+#endif
+
+  /* Start the manifest, whose jobs run alongside the commands read */
+  if (mpath)
+    loadmanifest(mpath, report);
+
+  /* Take control of the terminal when running on one interactively or
+   * w/ -c, so fg jobs can read it from their own process groups; with -p
+   * or a pipe on stdin, keyboard signals keep going through tsh's
+   * handlers instead */
+  if ((emit_prompt || command) && isatty(STDIN_FILENO))
+    initterm(!command);
+
+  /* Single command mode skips the rest of the REPL setup, as there's no
+   * prompt */
+  if (command) {
+    int status = evallist(command);
+    waitmanifest();
+    fflush(stdout);
+    exit(status);
+  }
 
   /* Execute the shell's read/eval loop */
   while (1) {
@@ -177,15 +714,21 @@ int main(int argc, char **argv) {
       printf("%s", prompt);
       fflush(stdout);
     }
+    unsigned long t0 = verbose ? nowns() : 0;
+    setidle(1); // bg jobs keep launching while tsh waits for input
     if ((fgets(cmdline, MAXLINE, stdin) == NULL) && ferror(stdin))
       app_error("fgets error");
+    setidle(0);
+    phase(P_READ, t0);
     if (feof(stdin)) { /* End of file (ctrl-d) */
+      waitmanifest();
       fflush(stdout);
       exit(0);
     }
 
     /* Evaluate the command line */
-    eval(cmdline);
+    interrupted = 0;
+    evallist(cmdline);
     fflush(stdout);
     fflush(stdout);
   }
@@ -193,6 +736,499 @@ int main(int argc, char **argv) {
   exit(0); /* control never reaches here */
 }
 
+/*
+ * evallist - Evaluate a list of commands joined by ';', '&', '&&' or '||',
+ *    possibly containing for & while loops. The whole list is parsed once
+ *    up front, then run by execlist. Returns the exit status of the last
+ *    command run.
+ */
+int evallist(const char *cmdline) {
+  const char *cur = cmdline;
+  struct node_t *list;
+
+  if (parselist(&cur, &list) < 0) // bad syntax, already reported
+    return last_status = 1;
+  if (*cur) { // list ended early at a stray do/done
+    fprintf(stderr, "Syntax error: unexpected '%s'\n",
+            keyword(cur, "do") ? "do" : "done");
+    freelist(list);
+    return last_status = 1;
+  }
+
+  execlist(list);
+  freelist(list);
+  return last_status;
+}
+
+/*
+ * execlist - Run each node of a parsed command list in order. A node
+ *    after '&&' ('||') is skipped unless the last node run succeeded
+ *    (failed), with the same short-circuiting as other shells. Commands
+ *    run through eval, so each one is a normal job. Once ctrl-c kills a
+ *    fg job, the rest of the list is skipped. Returns the exit status of
+ *    the last command run.
+ */
+int execlist(struct node_t *node) {
+  int run = 1; // whether to run the current node
+
+  for (; node && !interrupted; node = node->next) {
+    if (run) {
+      if (node->type == N_CMD)
+        execcmd(node->text);
+      else if (node->type == N_FOR)
+        execfor(node);
+      else
+        execwhile(node);
+    }
+
+    // skipped nodes leave last_status as is, so that the next operator
+    // short-circuits on the last status actually produced
+    run = node->op == OP_SEQ ||
+          (node->op == OP_AND ? last_status == 0 : last_status != 0);
+  }
+
+  return last_status;
+}
+
+/*
+ * execcmd - Run a single command's text through eval
+ */
+void execcmd(const char *text) {
+  char buf[MAXLINE]; // copy of the command, newline terminated
+  size_t len = strlen(text);
+
+  if (len > MAXLINE - 2) {
+    fprintf(stderr, "Command too long\n");
+    last_status = 1;
+    return;
+  }
+  memcpy(buf, text, len); // eval expects a newline terminated command
+  buf[len] = '\n';
+  buf[len + 1] = '\0';
+  eval(buf);
+  fflush(stdout); // keep tsh's output ordered with the next command's
+}
+
+/*
+ * execfor - Run a for loop's body once per word, with the loop var set to
+ *    the word. The words are expanded (including globs) once, when the
+ *    loop starts. A fg job killed by ctrl-c ends the loop.
+ */
+void execfor(struct node_t *node) {
+  char line[MAXLINE];       // word list, expanded & newline terminated
+  char expanded[MAXLINE];
+  char *words[MAXARGS];
+  char argbuf[MAXARGBUF];   // holds the strings words point into
+  int nwords = 0;
+
+  last_status = 0;
+  snprintf(line, MAXLINE, "%s\n", node->words);
+  if (expand(line, expanded) < 0 ||
+      parseline(expanded, &nwords, words, argbuf, sizeof(argbuf)) < 0) {
+    last_status = 1;
+    return;
+  }
+  if (!words[0]) // nothing to loop over
+    return;
+
+  for (int i = 0; i < nwords && !interrupted; i++) {
+    setvar(node->text, strlen(node->text), words[i], 0);
+    execlist(node->body);
+  }
+}
+
+/*
+ * execwhile - Run a while loop's body for as long as its condition list
+ *    succeeds. A fg job killed by ctrl-c ends the loop.
+ */
+void execwhile(struct node_t *node) {
+  int status = 0; // status of the last body run
+
+  while (execlist(node->cond) == 0 && !interrupted)
+    status = execlist(node->body);
+  if (!interrupted) // loop status is that of the body, not the condition
+    last_status = status;
+}
+
+/*
+ * parselist - Parse a command list starting at *sp into a linked list of
+ *    nodes, stopping at the end of the string or at a do/done keyword
+ *    (which is left for the enclosing loop to consume). Saves the list
+ *    (NULL if empty) in *list & advances *sp past what was parsed. Returns
+ *    0 on success, -1 on a syntax error (after alerting the user).
+ */
+int parselist(const char **sp, struct node_t **list) {
+  struct node_t *head = NULL;
+  struct node_t **tail = &head;
+  const char *s = *sp;
+  int len; // length of a leading keyword
+
+  for (;;) {
+    while (*s == ' ' || *s == ';' || *s == '\n') // skip empty commands
+      s++;
+    if (!*s || keyword(s, "do") || keyword(s, "done"))
+      break;
+
+    struct node_t *node = calloc(1, sizeof(struct node_t));
+    if (!node)
+      unix_error("parselist error");
+    *tail = node;
+    tail = &node->next;
+
+    if ((len = keyword(s, "for")) || (len = keyword(s, "while"))) {
+      node->type = s[0] == 'f' ? N_FOR : N_WHILE;
+      s += len;
+      if (parseloop(&s, node) < 0) {
+        freelist(head);
+        return -1;
+      }
+    } else {
+      const char *start = s;
+      const char *end = nextcmd(start, &node->op, &s);
+      if (end == start) { // an operator with no command before it
+        fprintf(stderr, "Syntax error: unexpected '%.2s'\n", start);
+        freelist(head);
+        return -1;
+      }
+      node->type = N_CMD;
+      node->text = strndup(start, end - start);
+    }
+
+    if (node->op == OP_END)
+      break;
+  }
+
+  *sp = s;
+  *list = head;
+  return 0;
+}
+
+/*
+ * parseloop - Parse the rest of a for loop ("for NAME in WORDS; do LIST;
+ *    done") or while loop ("while LIST; do LIST; done") into node, with
+ *    *sp just past the leading keyword, & then the operator after 'done'.
+ *    Advances *sp past what was parsed. Returns 0 on success, -1 on a
+ *    syntax error (after alerting the user).
+ */
+int parseloop(const char **sp, struct node_t *node) {
+  const char *s = *sp;
+  int len; // length of a keyword
+
+  while (*s == ' ')
+    s++;
+
+  if (node->type == N_FOR) { // NAME in WORDS;
+    const char *name = s;
+    while (isalnum(*s) || *s == '_')
+      s++;
+    if (s == name || isdigit(*name)) {
+      fprintf(stderr, "Syntax error: bad for loop variable\n");
+      return -1;
+    }
+    node->text = strndup(name, s - name);
+
+    while (*s == ' ')
+      s++;
+    if (!(len = keyword(s, "in"))) {
+      fprintf(stderr, "Syntax error: expected 'in' after for\n");
+      return -1;
+    }
+
+    int op;
+    const char *words = s + len;
+    const char *end = nextcmd(words, &op, &s);
+    if (op != OP_SEQ) {
+      fprintf(stderr, "Syntax error: expected ';' after for loop words\n");
+      return -1;
+    }
+    node->words = strndup(words, end - words);
+  } else { // LIST
+    if (parselist(&s, &node->cond) < 0)
+      return -1;
+    if (!node->cond) {
+      fprintf(stderr, "Syntax error: expected while loop condition\n");
+      return -1;
+    }
+  }
+
+  while (*s == ' ')
+    s++;
+  if (!(len = keyword(s, "do"))) {
+    fprintf(stderr, "Syntax error: expected 'do' in loop\n");
+    return -1;
+  }
+  s += len;
+
+  if (parselist(&s, &node->body) < 0) // an empty body is fine
+    return -1;
+  if (!(len = keyword(s, "done"))) {
+    fprintf(stderr, "Syntax error: expected 'done' to end loop\n");
+    return -1;
+  }
+  s += len;
+
+  // operator after done
+  while (*s == ' ')
+    s++;
+  if (!*s || (*s == '\n' && !s[1])) {
+    node->op = OP_END;
+    s += *s == '\n';
+  } else if (*s == ';' || *s == '\n') {
+    node->op = OP_SEQ;
+    s++;
+  } else if ((s[0] == '&' || s[0] == '|') && s[1] == s[0]) {
+    node->op = s[0] == '&' ? OP_AND : OP_OR;
+    s += 2;
+  } else if (keyword(s, "do") || keyword(s, "done")) {
+    node->op = OP_END; // end of the enclosing loop's list
+  } else {
+    fprintf(stderr, "Syntax error: unexpected '%.4s' after done\n", s);
+    return -1;
+  }
+
+  *sp = s;
+  return 0;
+}
+
+/*
+ * keyword - Return length of keyword kw if s starts with it as a word of
+ *    its own, else 0
+ */
+int keyword(const char *s, const char *kw) {
+  size_t len = strlen(kw);
+
+  if (strncmp(s, kw, len) != 0)
+    return 0;
+  return strchr(" ;\n", s[len]) ? len : 0; // also matches the null char
+}
+
+/* freelist - Free a parsed command list */
+void freelist(struct node_t *node) {
+  while (node) {
+    struct node_t *next = node->next;
+    freelist(node->cond);
+    freelist(node->body);
+    free(node->text);
+    free(node->words);
+    free(node);
+    node = next;
+  }
+}
+
+/*
+ * nextcmd - Find the end of the first command in a command list, skipping
+ *    over separators in single quotes or $(...). Returns a pointer just
+ *    past the command, saves the operator found there in op & points next
+ *    just past the operator. A trailing '&' is kept as part of the command
+ *    so parseline still sees it. A newline that isn't the last char acts
+ *    like ';'.
+ */
+const char *nextcmd(const char *cmdline, int *op, const char **next) {
+  const char *c;  // current char
+  int quoted = 0; // true while inside single quotes
+  int depth = 0;  // nesting depth of command substitutions
+
+  for (c = cmdline; *c && !(*c == '\n' && !quoted && !depth); c++) {
+    if (*c == '\'')
+      quoted = !quoted;
+    if (quoted)
+      continue;
+
+    if (c[0] == '$' && c[1] == '(') {
+      depth++;
+      c++;
+      continue;
+    }
+    if (depth) { // separators inside $(...) belong to the inner list
+      depth -= *c == ')';
+      continue;
+    }
+
+    if (*c == ';') {
+      *op = OP_SEQ;
+      *next = c + 1;
+      return c;
+    }
+    if ((c[0] == '&' || c[0] == '|') && c[1] == c[0]) {
+      *op = c[0] == '&' ? OP_AND : OP_OR;
+      *next = c + 2;
+      return c;
+    }
+    if (*c == '&') { // end bg command after its '&', as if '&;'
+      *op = OP_SEQ;
+      *next = c + 1;
+      return c + 1;
+    }
+  }
+
+  // newline or end of string ends the list, unless more lines follow
+  *op = *c && c[1] ? OP_SEQ : OP_END;
+  *next = *c ? c + 1 : c;
+  return c;
+}
+
+/*
+ * expand - Copy cmdline into dest, replacing each $(...) outside single
+ *    quotes with the output of the command list inside it & each $NAME,
+ *    ${NAME}, $? or $$ with the variable's value. Returns 0 on success, or
+ *    -1 (after alerting the user) if the result won't fit in MAXLINE or a
+ *    $(...) or ${NAME} is unterminated.
+ */
+int expand(const char *cmdline, char *dest) {
+  char *d = dest;                 // next free char in dest
+  char *dend = dest + MAXLINE - 1; // leave room for the null terminator
+  char inner[MAXLINE];            // command list of a substitution
+  int quoted = 0;                 // true while inside single quotes
+
+  for (const char *c = cmdline; *c; c++) {
+    if (*c == '\'')
+      quoted = !quoted;
+
+    if (!quoted && c[0] == '$' && c[1] == '(') {
+      const char *close = matchparen(c + 2);
+      if (!close) {
+        fprintf(stderr, "Unterminated command substitution\n");
+        return -1;
+      }
+
+      size_t len = close - (c + 2);
+      if (len > MAXLINE - 1) {
+        fprintf(stderr, "Command too long\n");
+        return -1;
+      }
+      memcpy(inner, c + 2, len);
+      inner[len] = '\0';
+
+      int n = cmdsubst(inner, d, dend - d);
+      if (n < 0)
+        return -1;
+      d += n;
+      c = close; // resume after the closing paren
+      continue;
+    }
+
+    if (!quoted && c[0] == '$') {
+      const char *name = c + 1; // var name, & the char just past it
+      const char *end = name;
+      char num[16];
+      char *val = NULL;
+
+      if (*name == '?' || *name == '$') { // special vars
+        snprintf(num, sizeof(num), "%d",
+                 *name == '?' ? last_status : (int)getpid());
+        val = num;
+        end = name + 1;
+      } else if (*name == '{') {
+        if (!(end = strchr(name, '}'))) {
+          fprintf(stderr, "Unterminated variable substitution\n");
+          return -1;
+        }
+        val = getvar(name + 1, end - name - 1);
+        end++;
+      } else {
+        while (isalnum(*end) || *end == '_')
+          end++;
+        if (end != name)
+          val = getvar(name, end - name);
+      }
+
+      if (end != name) { // unset vars expand to nothing
+        size_t len = val ? strlen(val) : 0;
+        if (len > (size_t)(dend - d)) {
+          fprintf(stderr, "Command too long\n");
+          return -1;
+        }
+        memcpy(d, val, len);
+        d += len;
+        c = end - 1;
+        continue;
+      }
+    }
+
+    if (d == dend) {
+      fprintf(stderr, "Command too long\n");
+      return -1;
+    }
+    *d++ = *c;
+  }
+
+  *d = '\0';
+  return 0;
+}
+
+/*
+ * matchparen - Return pointer to the ')' closing the $( that s follows,
+ *    accounting for nested substitutions & quotes, or NULL if unclosed.
+ */
+const char *matchparen(const char *s) {
+  int depth = 1;
+  int quoted = 0;
+
+  for (; *s; s++) {
+    if (*s == '\'')
+      quoted = !quoted;
+    if (quoted)
+      continue;
+
+    if (s[0] == '$' && s[1] == '(') {
+      depth++;
+      s++;
+    } else if (*s == ')' && --depth == 0) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+/*
+ * cmdsubst - Run the command list cmds with its stdout captured in a
+ *    memfd & copy the output into dest (of given size), with newlines
+ *    turned into spaces & trailing ones dropped. Builtins like echo, pwd
+ *    & jobs run inside tsh without forking; other commands become normal
+ *    fg jobs that inherit the memfd as stdout. Returns number of chars
+ *    written, or -1 on error.
+ */
+int cmdsubst(const char *cmds, char *dest, size_t size) {
+  FLOGINFO("substituting output of: %s", cmds);
+
+  int fd = memfd_create("tsh-subst", MFD_CLOEXEC);
+  if (fd < 0) {
+    fprintf(stderr, "Unable to capture command output: %s\n",
+            strerror(errno));
+    return -1;
+  }
+
+  // point stdout at the memfd while the list runs, then put it back
+  fflush(stdout);
+  int saved = dup(STDOUT_FILENO);
+  dup2(fd, STDOUT_FILENO);
+  int status = last_status; // a substitution doesn't change $?
+  evallist(cmds);
+  last_status = status;
+  fflush(stdout);
+  dup2(saved, STDOUT_FILENO);
+  close(saved);
+
+  ssize_t len = pread(fd, dest, size, 0);
+  close(fd);
+  if (len < 0) {
+    fprintf(stderr, "Unable to read command output: %s\n", strerror(errno));
+    return -1;
+  }
+  if ((size_t)len == size) { // output may have been cut off
+    fprintf(stderr, "Command too long\n");
+    return -1;
+  }
+
+  while (len > 0 && dest[len - 1] == '\n') // drop trailing newlines
+    len--;
+  for (ssize_t i = 0; i < len; i++) // split the rest into words
+    if (dest[i] == '\n')
+      dest[i] = ' ';
+
+  return len;
+}
+
 /*
  * eval - Evaluate the command line that the user has just typed in
  *
@@ -203,21 +1239,113 @@ int main(int argc, char **argv) {
  * each child process must have a unique process group ID so that our
  * background children don't receive SIGINT (SIGTSTP) from the kernel
  * when we type ctrl-c (ctrl-z) at the keyboard.
+ *
+ * Returns the command's exit status (0 for builtins & bg jobs), which is
+ * also saved in last_status.
  */
-void eval(char *cmdline) {
+int eval(char *cmdline) {
   LOGINFO("begin eval");
+  unsigned long t0 = nowns();
+
+  char expanded[MAXLINE]; // cmdline with substitutions made
+  if (expand(cmdline, expanded) < 0)
+    return last_status = 1;
 
   int argc;
-  char *argv[MAXARGS]; // parse commandline into args
-  int bg = parseline(
-      cmdline, &argc,
-      argv); // parseline returns truthy iff command is to be run in background
+  char *argv[MAXARGS];    // parse commandline into args
+  char argbuf[MAXARGBUF]; // holds the strings argv points into
+  int bg = parseline(expanded, &argc, argv, argbuf,
+                     sizeof(argbuf)); // truthy iff to run in background
+  if (bg < 0) // bad args, already reported
+    return last_status = 1;
+  histadd(H_PARSE, nowns() - t0);
+  phase(P_PARSE, t0);
+  if (argv[0] == NULL) // nothing to do for a blank command
+    return last_status = 0;
+
+  // leading NAME=value words set vars for this command only, or for the
+  // shell if they're all there is
+  int nassign = 0;
+  while (nassign < argc && isassign(argv[nassign]))
+    nassign++;
+  if (nassign == argc) {
+    for (int i = 0; i < nassign; i++) {
+      char *eq = strchr(argv[i], '=');
+      setvar(argv[i], eq - argv[i], eq + 1, 0);
+    }
+    return last_status = 0;
+  }
+  char *assigns[MAXARGS]; // applied on top of envp in the child
+  memcpy(assigns, argv, nassign * sizeof(char *));
+  memmove(argv, argv + nassign, (argc - nassign + 1) * sizeof(char *));
+  argc -= nassign;
+  if (nassign && !vars) // overlayenv needs the var table
+    initvars();
+  char **env = getenvp(); // build before forking so later forks reuse it
+
+  // a cached prefix replays the result of an identical earlier run, or
+  // saves this one's. That needs the command's output, so it can't be bg
+  if (strcmp("cached", argv[0]) == 0) {
+    if (bg) {
+      fprintf(stderr, "cached: can't run in the background\n");
+      return last_status = 1;
+    }
+    if (argc == 1) {
+      cachestats();
+      return last_status = 0;
+    }
+    return runcached(expanded, argc - 1, argv + 1, assigns, nassign, env);
+  }
+
+  // time & bench prefixes measure the rest of the command, so wait for it
+  int timed = strcmp("time", argv[0]) == 0;
+  if (timed || strcmp("bench", argv[0]) == 0) {
+    if (bg) {
+      fprintf(stderr, "%s: can't run in the background\n", argv[0]);
+      return last_status = 1;
+    }
+    if (!timed)
+      return runbench(expanded, argc, argv, assigns, nassign, env);
+    if (argc == 1) {
+      fprintf(stderr, "usage: time cmd args...\n");
+      return last_status = 1;
+    }
+    return runtimed(expanded, argc - 1, argv + 1, assigns, nassign, env);
+  }
+
+  return runcmd(expanded, argc, argv, assigns, nassign, env, bg);
+}
+
+/*
+ * runcmd - Run the command of an expanded command line, split into argc
+ *    args & n NAME=value assigns, as a builtin or else as a fg or bg job
+ *    w/ the environment env. Returns the exit status, also saved in
+ *    last_status.
+ */
+int runcmd(char *expanded, int argc, char **argv, char **assigns, int nassign,
+           char **env, int bg) {
+  int status = spawncmd(expanded, argc, argv, assigns, nassign, env, bg);
 
+  if (verbose) // on every path, so no phase is left over for the next one
+    printphases(argv[0]);
+  return status;
+}
+
+/*
+ * spawncmd - Do the work of runcmd, w/o logging the command's phases.
+ *    Returns the exit status, also saved in last_status.
+ */
+int spawncmd(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env, int bg) {
   FLOGINFO("%s: checking if builtin command...", argv[0]);
+  last_status = 0; // builtins that report a status overwrite this
+  unsigned long t0 = nowns();
   int is_builtin =
       builtin_cmd(argc, argv); // run as builtin command, if builtin
+  phase(P_BUILTIN, t0);
 
   if (!is_builtin) { // otherwise, handle command
+    histadd(H_LOOKUP, nowns() - t0);
     FLOGINFO(
         "%s: %s",
         "not a builtin command, attempting to exec command in child process",
@@ -237,67 +1365,126 @@ void eval(char *cmdline) {
     // block sigchld while creating new child to prevent race before ready to
     // handle child signals
     LOGINFO("blocking SIGCHLD");
+    t0 = verbose ? nowns() : 0;
     if (sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset) != 0)
       fprintf(stderr, "WARNING: failed to block SIGCHLD");
+    phase(P_BLOCK, t0);
+
+    // w/ dedup on, a bg job identical to one already running or queued
+    // attaches to it instead of forking another copy
+    char packed[MAXLINE];
+    int packedlen = packargs(packed, assigns, nassign, argv, argc);
+    unsigned long key = 0;
+    if (bg && dedup.on && packedlen >= 0) {
+      key = jobkey(packed, packedlen);
+      struct job_t *twin = findtwin(key, packed, packedlen);
+      if (twin) {
+        dedup.saved++;
+        sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore sig mask
+        printf("[%d] Attached %s", twin->jid, twin->cmdline);
+        return last_status = 0;
+      }
+    }
+
+    // with every job slot in use, or launches over the rate limit, queue
+    // bg jobs to launch later. Jobs already queued go first, so a new one
+    // can't take a freshly refilled token ahead of them
+    int noslot = bg && runningjobs() >= jobslots;
+    if (bg && (noslot || queuedjobs() || !taketoken())) {
+      LOGINFO("no free job slot or launch token, queueing job");
+      struct job_t *job = queuejob(expanded, assigns, nassign, argv, argc);
+      if (job)
+        job->key = key;
+      if (job && !noslot && ratelimit.rate > 0) { // the rate limit's doing
+        job->deferred = 1;
+        ratelimit.deferred++;
+        armtimer(tokenwait());
+      }
+      sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore sig mask
+      if (!job)
+        return last_status = 1;
+      printf("[%d] Queued %s", job->jid, job->cmdline);
+      return last_status = 0;
+    }
 
     LOGINFO("attempting to create child process");
+    forkat = nowns();
     pid_t pid = fork(); // fork & exec program in child process
+    if (pid > 0) {
+      histadd(H_FORK, nowns() - forkat);
+      phase(P_FORK, forkat);
+    }
     if (pid == -1) {    // handle fork error
       fprintf(stderr, "Unable to fork child process for: %s",
-              cmdline);                             // warn user
+              expanded);                             // warn user
       sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore sig mask
-      return;                                       // quit eval
+      return last_status = 1;                       // quit eval
     }
 
-    if (pid == 0) { // BEGIN CHILD PROC
-      setpgrp();    // ensure all children are in own process group
-      if (sigprocmask(SIG_UNBLOCK, &mask_sigchld, NULL) !=
-          0) // allow child to handle sigchld
-        fprintf(stderr, "WARNING: failed to unblock SIGCHLD");
-
-      FLOGINFO("%s: executing command in child process...", argv[0]);
-      int result = execv(argv[0], argv); // exec command program
-      if (result < 0) { // execv returns negative if command isn't found
-        printf("%s: Command not found\n", argv[0]);
-        exit(1);
-      }
-
-      LOGINFO("...done. exiting child process");
-      exit(0); // "return early" by exiting child process w/ success state
-    } // END CHILD PROC
+    if (pid == 0) // CHILD PROC
+      execjob(argv, env, assigns, nassign, !bg, NULL);
 
     // PARENT PROC (TSH) RESUMES HERE
-    int state = bg ? BG : FG;                          // determine job state
-    int job_added = addjob(jobs, pid, state, cmdline); // add job to jobs list
+    PROBE3(job_spawn, pid, expanded, !bg);
+    setpgid(pid, pid); // as in the child, so the job can be signalled now
+    if (!bg) // hand tty to job from parent too, whichever runs first wins
+      giveterm(pid);
+
+    int state = bg ? BG : FG; // determine job state
+    t0 = verbose ? nowns() : 0;
+    struct job_t *job_added =
+        addjob(jobs, pid, state, expanded); // add job to jobs list
+    phase(P_ADDJOB, t0);
 
     if (!job_added) { // handle error adding job
-      fprintf(stderr, "Failed to create job for %s", cmdline); // alert user
-      return;                                                  // quit eval
+      fprintf(stderr, "Failed to create job for %s", expanded); // alert user
+      sigprocmask(SIG_UNBLOCK, &mask_sigchld, NULL);
+      return last_status = 1; // quit eval
     }
+    if ((job_added->argslen = packedlen) >= 0) // for dedup
+      memcpy(job_added->args, packed, packedlen);
+    job_added->nassign = nassign;
+    job_added->nargs = nassign + argc;
+    job_added->key = key;
+    int jid = job_added->jid; // a bg job may be reaped once unblocked
 
     sigprocmask(SIG_UNBLOCK, &mask_sigchld, NULL); // ready to handle sigchld
 
     if (bg) // show pid and jid then return control immediately
-      printf("[%d] (%d) %s", pid2jid(pid), pid, cmdline);
-    else // wait for job to term or stop before returning control to user
-      waitfg(pid);
+      printf("[%d] (%d) %s", jid, pid, expanded);
+    else { // wait for job to term or stop before returning control to user
+      t0 = verbose ? nowns() : 0;
+      last_status = waitfg(pid);
+      phase(P_WAITFG, t0);
+    }
   }
+
+  return last_status;
 }
 
 /*
  * parseline - Parse the command line and build the argv array.
  *
  * Characters enclosed in single quotes are treated as a single
- * argument.  Return true if the user has requested a BG job, false if
- * the user has requested a FG job.
+ * argument; other args with glob patterns expand to the matching file
+ * names. Return true if the user has requested a BG job, false if
+ * the user has requested a FG job, or -1 if the args don't fit. The args
+ * are stored in the caller's buffer buf (of the given size), so nested
+ * calls don't clobber each other.
  */
-int parseline(const char *cmdline, int *argc_dest, char **argv) {
-  static char array[MAXLINE]; /* holds local copy of command line */
-  char *buf = array;          /* ptr that traverses command line */
-  char *delim;                /* points to first space delimiter */
+int parseline(const char *cmdline, int *argc_dest, char **argv, char *buf,
+              size_t size) {
+  char *delim; /* points to first space delimiter */
   int argc;
   int bg; /* background job? */
+  int quoted[MAXARGS]; /* whether each arg was quoted */
+  size_t len = strlen(cmdline) + 1;
+  char *pool = buf + len; /* free space after the args */
 
+  if (len > size) {
+    fprintf(stderr, "Command too long\n");
+    return -1;
+  }
   strcpy(buf, cmdline);
   buf[strlen(buf) - 1] = ' ';   /* replace trailing '\n' with space */
   while (*buf && (*buf == ' ')) /* ignore leading spaces */
@@ -305,7 +1492,7 @@ int parseline(const char *cmdline, int *argc_dest, char **argv) {
 
   /* Build the argv list */
   argc = 0;
-  if (*buf == '\'') {
+  if ((quoted[argc] = *buf == '\'')) {
     buf++;
     delim = strchr(buf, '\'');
   } else {
@@ -313,13 +1500,17 @@ int parseline(const char *cmdline, int *argc_dest, char **argv) {
   }
 
   while (delim) {
+    if (argc == MAXARGS - 1) {
+      fprintf(stderr, "Argument list too long\n");
+      return -1;
+    }
     argv[argc++] = buf;
     *delim = '\0';
     buf = delim + 1;
     while (*buf && (*buf == ' ')) /* ignore spaces */
       buf++;
 
-    if (*buf == '\'') {
+    if ((quoted[argc] = *buf == '\'')) {
       buf++;
       delim = strchr(buf, '\'');
     } else {
@@ -331,6 +1522,10 @@ int parseline(const char *cmdline, int *argc_dest, char **argv) {
   if (argc == 0) /* ignore blank line */
     return 1;
 
+  /* Expand glob patterns */
+  if (globargs(&argc, argv, quoted, pool, size - len) < 0)
+    return -1;
+
   /* should the job run in the background? */
   if ((bg = (*argv[argc - 1] == '&')) != 0) {
     argv[--argc] = NULL;
@@ -353,15 +1548,113 @@ int builtin_cmd(int argc, char **argv) {
     exit(0);
   }
 
-  // jobs command shows jobs list
-  if (strcmp("jobs", argv[0]) == 0) {
-    LOGINFO("jobs builtin received, printing jobs list");
-    listjobs(jobs);
+  // echo, printf & pwd write straight from tsh, without forking
+  if (strcmp("echo", argv[0]) == 0) {
+    do_echo(argc, argv);
     return 1;
   }
-
-  // bg & fg commands
-  if (strcmp("bg", argv[0]) == 0 || strcmp("fg", argv[0]) == 0) {
+  if (strcmp("printf", argv[0]) == 0) {
+    do_printf(argc, argv);
+    return 1;
+  }
+  if (strcmp("pwd", argv[0]) == 0) {
+    char cwd[MAXLINE];
+    if (getcwd(cwd, MAXLINE))
+      printf("%s\n", cwd);
+    else
+      fprintf(stderr, "pwd: %s\n", strerror(errno));
+    return 1;
+  }
+
+  // export & unset commands manage shell variables
+  if (strcmp("export", argv[0]) == 0) {
+    do_export(argc, argv);
+    return 1;
+  }
+  if (strcmp("unset", argv[0]) == 0) {
+    for (int i = 1; i < argc; i++)
+      unsetvar(argv[i]);
+    return 1;
+  }
+
+  // jobs command shows jobs list
+  if (strcmp("jobs", argv[0]) == 0) {
+    LOGINFO("jobs builtin received, printing jobs list");
+    if (argc == 1)
+      listjobs(jobs);
+    else
+      do_jobs(argc, argv);
+    return 1;
+  }
+
+  // stats command prints (or resets) tsh's latency histograms
+  if (strcmp("stats", argv[0]) == 0) {
+    do_stats(argc, argv);
+    return 1;
+  }
+
+  // kill command signals jobs
+  if (strcmp("kill", argv[0]) == 0) {
+    do_kill(argc, argv);
+    return 1;
+  }
+
+  // tag command tags jobs, for @tag job specs
+  if (strcmp("tag", argv[0]) == 0) {
+    do_tag(argc, argv);
+    return 1;
+  }
+
+  // jobslots command shows or sets the limit of jobs running at once
+  if (strcmp("jobslots", argv[0]) == 0) {
+    do_jobslots(argc, argv);
+    return 1;
+  }
+
+  // parallel command fans a command out over inputs
+  if (strcmp("parallel", argv[0]) == 0) {
+    do_parallel(argc, argv);
+    return 1;
+  }
+
+  // after command runs a job once other jobs exit
+  if (strcmp("after", argv[0]) == 0) {
+    do_after(argc, argv);
+    return 1;
+  }
+
+  // dedup command turns attaching to identical bg jobs on or off
+  if (strcmp("dedup", argv[0]) == 0) {
+    do_dedup(argc, argv);
+    return 1;
+  }
+
+  // wait command waits for jobs to exit
+  if (strcmp("wait", argv[0]) == 0) {
+    do_wait(argc, argv);
+    return 1;
+  }
+
+  // batch command runs a command w/ as many inputs per job as fit
+  if (strcmp("batch", argv[0]) == 0) {
+    do_batch(argc, argv);
+    return 1;
+  }
+
+  // launchrate command shows or sets the bg job launch rate limit
+  if (strcmp("launchrate", argv[0]) == 0) {
+    do_launchrate(argc, argv);
+    return 1;
+  }
+
+  // supervise command runs a job that's restarted whenever it exits
+  if (strcmp("supervise", argv[0]) == 0) {
+    do_supervise(argc, argv);
+    return 1;
+  }
+
+  // bg & fg commands
+  if (strcmp("bg", argv[0]) == 0 || strcmp("fg", argv[0]) == 0) {
     FLOGINFO("%s builtin received, forwarding command to handler", argv[0]);
     do_bgfg(argc, argv);
     return 1;
@@ -371,356 +1664,3653 @@ int builtin_cmd(int argc, char **argv) {
 }
 
 /*
- * do_bgfg - Execute the builtin bg and fg commands
+ * do_bgfg - Execute the builtin bg and fg commands. bg takes any number of
+ *    job specs (see selectjobs), fg takes a spec matching exactly one job.
  */
 void do_bgfg(int argc, char **argv) {
   FLOGINFO("%s command received with arg %s, handling...", argv[0], argv[1]);
+  int fg = strcmp("fg", argv[0]) == 0;
 
   // ensure command syntax is correct
   // check arg length correct
-  if (argc != 2) {
+  if (argc < 2 || (fg && argc != 2)) {
     fprintf(stderr, "%s command requires PID or %%jobid argument\n", argv[0]);
     return;
   }
 
-  // parse arg
-  char *id_str = argv[1];
-  int is_jid = 0;
-  if (id_str[0] == '%') {
-    is_jid = 1;
-    id_str++;
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  struct job_t *sel[MAXJOBS]; // requested jobs
+  int n = selectjobs(argv[0], argc - 1, argv + 1, sel);
+  if (fg && n > 1) {
+    fprintf(stderr, "fg: %s matches %d jobs\n", argv[1], n);
+    n = 0;
   }
 
-  // id str -> num conversion
-  char *endptr; // stores ptr first invalid char in num conversion
-  long id_lng = strtol(id_str, &endptr, 10);
-  // check for conversion error
-  if (*endptr != '\0') { // num converted successfully if endptr is null char
-    fprintf(stderr, "%s: argument must be a PID or %%jobid\n", argv[0]);
-    return;
+  for (int i = 0; i < n; i++) {
+    struct job_t *job = sel[i];
+
+    if (!job->pid) { // queued, blocked or restarting: launch now
+      if (!startjob(job, fg ? FG : BG))
+        continue;
+    } else {
+      if (fg) // job must own tty before it resumes
+        giveterm(job->pid);
+      kill(-job->pid, SIGCONT); // resume job process
+      PROBE2(job_continue, job->jid, job->pid);
+    }
+
+    job->state = fg ? FG : BG;
+    job->touched = ++jobclock;
+    if (!fg)
+      printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline); // update user
   }
-  int id = id_lng; // coerce long to int
 
-  struct job_t *job = is_jid                     // get requested job data
-                          ? getjobjid(jobs, id)  // by jid if %
-                          : getjobpid(jobs, id); // else by pid
-  if (!job) {                                    // alert user if bad job id/pid
-    char *fmt = is_jid ? "%%%d: No such job\n" : "(%d): No such process\n";
-    fprintf(stderr, fmt, id);
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  if (fg && n == 1)
+    last_status = waitfg(sel[0]->pid); // wait for job to complete
+}
+
+/*
+ * do_jobs - Execute the builtin jobs command w/ args, jobs [-l] [jobspec...],
+ *    which lists the matching jobs, or all of them. W/ -l, each job is
+ *    followed by its wall time & resource usage so far, & jobs finished
+ *    since the last jobs -l are listed too. jobs -c lists the finished
+ *    jobs still in history instead, oldest first.
+ */
+void do_jobs(int argc, char **argv) {
+  struct job_t *sel[MAXJOBS];
+  int full = strcmp(argv[1], "-l") == 0, n = 0;
+  struct timespec now;
+
+  if (strcmp(argv[1], "-c") == 0) {
+    if (argc == 2)
+      listdone();
+    else {
+      fprintf(stderr, "usage: jobs -c\n");
+      last_status = 1;
+    }
     return;
   }
 
-  kill(-job->pid, SIGCONT); // resume job process
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
 
-  if (strcmp("bg", argv[0]) == 0) {                           // handle bg
-    printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline); // update user
-    job->state = BG;  // update job status to background
-  } else {            // handle fg
-    job->state = FG;  // update job status to foreground
-    waitfg(job->pid); // wait for job to complete
+  if (argc > 1 + full)
+    n = selectjobs(argv[0], argc - 1 - full, argv + 1 + full, sel);
+  else
+    for (int i = 0; i < MAXJOBS; i++)
+      if (jobs[i].jid)
+        sel[n++] = &jobs[i];
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < n; i++) {
+    struct rusage ru;
+
+    printjob(sel[i]);
+    if (full && sel[i]->pid && procusage(sel[i]->pid, &ru) == 0)
+      printusage((now.tv_sec - sel[i]->started.tv_sec) +
+                     (now.tv_nsec - sel[i]->started.tv_nsec) / 1e9,
+                 &ru);
+  }
+
+  if (full && argc == 2) { // jobs finished since the last jobs -l
+    if (ndonejobs - listeddone > MAXDONE)
+      listeddone = ndonejobs - MAXDONE;
+    for (; listeddone < ndonejobs; listeddone++) {
+      struct done_t *done = &donejobs[listeddone % MAXDONE];
+      if (!done->pid) // never ran
+        continue;
+      printf("[%d] (%d) Done (status %d)\n", done->jid, done->pid,
+             done->status);
+      printusage(done->wall, &done->ru);
+    }
   }
+
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
 }
 
 /*
- * waitfg - Block until process pid is no longer the foreground process
+ * listdone - Print the history of finished jobs, oldest first: each job's
+ *    JID, PID, how it ended, when it started & exited, & its command
+ *    line, followed by its resource usage. The history is donejobs, so
+ *    it holds the last MAXDONE jobs at most.
  */
-void waitfg(pid_t pid) {
-  sigset_t mask_none, prev_mask; // allow receiving of all signals while waiting
-  sigemptyset(&mask_none);
-  sigprocmask(SIG_BLOCK, &mask_none, &prev_mask);
-
-  int waiting = 1; // init waiting to True
+void listdone(void) {
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
 
-  while (waiting) {
-    struct job_t *job = getjobpid(jobs, pid); // check if still waiting
-    waiting = (job && job->state == FG) ? 1 : 0;
+  unsigned long oldest = ndonejobs > MAXDONE ? ndonejobs - MAXDONE : 0;
+  for (unsigned long i = oldest; i < ndonejobs; i++) {
+    struct done_t *done = &donejobs[i % MAXDONE];
+    struct tm tm;
+    char when[32];
+    double began = done->ended.tv_sec + done->ended.tv_nsec / 1e9 - done->wall;
+    time_t start = began;
 
-    if (waiting) // pause until a signal is received
-      pause();
-    // NOTE: all actual signal handling will be done in sig handlers,
-    //       including updating job status on appropriate signals
+    localtime_r(&start, &tm);
+    size_t len = strftime(when, sizeof(when), "%F %T", &tm);
+    snprintf(when + len, sizeof(when) - len, ".%03d",
+             (int)((began - start) * 1000));
+    if (done->pid)
+      printf("[%d] (%d) ", done->jid, done->pid);
+    else // never ran
+      printf("[%d] (-) ", done->jid);
+    if (WIFSIGNALED(done->wstatus))
+      printf("Signal %d ", WTERMSIG(done->wstatus));
+    else
+      printf("Exit %d ", done->status);
+    printf("%s +%.3fs %s", when, done->wall, done->cmdline);
+    printusage(done->wall, &done->ru);
   }
-  sigprocmask(SIG_BLOCK, &prev_mask,
-              NULL); // when done waiting, restore previous mask
-}
 
-/*****************
- * Signal handlers
- *****************/
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
 
 /*
- * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
- *     a child job terminates (becomes a zombie), or stops because it
- *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
- *     available zombie children, but doesn't wait for any other
- *     currently running children to terminate.
+ * printusage - Print a job's wall time & resource usage, as a line
+ *    following it in jobs -l
  */
-void sigchld_handler(int _) {
-  LOGINFO("SIGCHLD caught, handling...");
-  int pid;                           // to store pid of changed child proc
-  int status;                        // to store child proc status
-  sigset_t mask_sigall, prev_sigset; // signal set masks
+void printusage(double wall, struct rusage *ru) {
+  printf("    wall %.3fs  user %.3fs  sys %.3fs  maxrss %ldk  csw %ld+%ld\n",
+         wall, ru->ru_utime.tv_sec + ru->ru_utime.tv_usec / 1e6,
+         ru->ru_stime.tv_sec + ru->ru_stime.tv_usec / 1e6, ru->ru_maxrss,
+         ru->ru_nvcsw, ru->ru_nivcsw);
+}
 
-  // block all signals while handline sigchld
-  sigfillset(&mask_sigall);
-  sigprocmask(SIG_BLOCK, &mask_sigall, &prev_sigset);
+/*
+ * procusage - Fill ru w/ the resource usage so far of the running process
+ *    pid (not its children), from /proc, as wait4 only reports it once the
+ *    process exits. Returns 0 on success, or -1 if pid's gone.
+ */
+int procusage(pid_t pid, struct rusage *ru) {
+  char path[64], buf[1024], *c;
+  unsigned long utime, stime;
+  long hz = sysconf(_SC_CLK_TCK);
+  FILE *f;
 
-  // reap and update ALL children necessary
-  while ((pid = waitpid(-1,           // wait for ANY child to term/stop
-                        &status,      // save status here
-                        WNOHANG |     // poll instead of blocking
-                            WUNTRACED // get stopped jobs too, not just termed
-                        )) > 0) {
-    FLOGINFO("Child proc (%d) changed, checking status...", pid);
+  memset(ru, 0, sizeof(*ru));
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+  c = fgets(buf, sizeof(buf), f) ? strrchr(buf, ')') : NULL; // past comm
+  fclose(f);
+  if (!c || sscanf(c + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+                   &utime, &stime) != 2)
+    return -1;
+  ru->ru_utime.tv_sec = utime / hz;
+  ru->ru_utime.tv_usec = utime % hz * 1000000 / hz;
+  ru->ru_stime.tv_sec = stime / hz;
+  ru->ru_stime.tv_usec = stime % hz * 1000000 / hz;
 
-    // handle the following cases:
-    // 1. child termed due to exit
-    if (WIFEXITED(status)) {
-      LOGINFO("process exited, requesting deletion...");
-      deletejob(jobs, pid); // then remove from jobs list
+  snprintf(path, sizeof(path), "/proc/%d/status", pid);
+  if (!(f = fopen(path, "r")))
+    return -1;
+  while (fgets(buf, sizeof(buf), f)) {
+    sscanf(buf, "VmHWM: %ld", &ru->ru_maxrss);
+    sscanf(buf, "voluntary_ctxt_switches: %ld", &ru->ru_nvcsw);
+    sscanf(buf, "nonvoluntary_ctxt_switches: %ld", &ru->ru_nivcsw);
+  }
+  fclose(f);
+  return 0;
+}
 
-      // handler done, cleanup
-      sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
-      return; // return early to end processing
-    }
+/*
+ * do_kill - Execute the builtin kill command,
+ *        kill [-s SIG | -SIG | -N] jobspec...
+ *    which sends a signal (default SIGTERM) to each matching job's process
+ *    group. Jobs not launched yet are cancelled by signals that would end
+ *    them. Supervised jobs killed this way aren't restarted, except after
+ *    SIGSTOP/SIGCONT-like signals.
+ */
+void do_kill(int argc, char **argv) {
+  int sig = SIGTERM, i = 1;
 
-    // 2. child termed due to signal
-    if (WIFSIGNALED(status)) {
-      int sig = WTERMSIG(status);
-      struct job_t *job = getjobpid(jobs, pid); // get job data
-      if (!job)
-        FLOGERR("error terminating job, no job found for pid (%d)", pid);
-      int jid = job->jid;
-      deletejob(jobs, pid); // then remove from jobs list
-      printf("Job [%d] (%d) terminated by signal %d\n", jid, pid,
-             sig); // & print confirmation
+  if (i < argc && strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+    sig = signum(argv[i + 1]);
+    i += 2;
+  } else if (i < argc && argv[i][0] == '-' && argv[i][1] != '\0') {
+    sig = signum(argv[i] + 1);
+    i++;
+  }
+  if (sig < 0 || i >= argc) {
+    fprintf(stderr, "usage: kill [-s SIG | -SIG | -N] jobspec...\n");
+    last_status = 1;
+    return;
+  }
+  int ending = sig == SIGTERM || sig == SIGKILL || sig == SIGINT ||
+               sig == SIGHUP || sig == SIGQUIT;
 
-      // handler done, cleanup
-      sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
-      return; // return early to end processing
-    }
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
 
-    // 3. child stopped due to signal
-    if (WIFSTOPPED(status)) {
-      int sig = WSTOPSIG(status);
-      FLOGINFO("process  stopped due to signal %d", sig);
-      struct job_t *job = getjobpid(jobs, pid); // get job data
-      if (!job)
-        FLOGERR("error updating job, no job found for pid (%d)", pid);
-      job->state = ST; // update state to Stopped
-      printf("Job [%d] (%d) stopped by signal %d\n", job->jid, pid,
-             sig); // & print confirmation
+  struct job_t *sel[MAXJOBS];
+  int n = selectjobs(argv[0], argc - i, argv + i, sel);
+  for (int j = 0; j < n; j++) {
+    struct job_t *job = sel[j];
 
-      // handler done, cleanup
-      sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
-      return; // return early to end processing
+    if (ending)
+      job->supervised = 0;
+    if (job->pid) {
+      if (kill(-job->pid, sig) < 0)
+        fprintf(stderr, "kill: (%d): %s\n", job->pid, strerror(errno));
+      else if (sig == SIGCONT && job->state == ST) {
+        job->state = BG;
+        PROBE2(job_continue, job->jid, job->pid);
+      }
+    } else if (ending) { // never launched, so cancel it
+      printf("Job [%d] cancelled\n", job->jid);
+      jobexited(job, sig, NULL); // as if killed by sig
+      clearjob(job);
+      nextjid = maxjid(jobs) + 1;
     }
-
-    // ERROR -- if this point is reached, then something has gone wrong
-    sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
-    unix_error("Unhandled SIGCHLD received, unable to continue."); // exit
   }
+  launchqueued(); // cancelled jobs may have held slots for dependents
+
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
 }
 
 /*
- * sigint_handler - The kernel sends a SIGINT to the shell whenever the
- *    user types ctrl-c at the keyboard. Catch it and send it along
- *    to the foreground job.
+ * signum - Get the number of a signal given as a number or a name, w/ or
+ *    w/o its SIG prefix. Returns -1 if unknown.
  */
-void sigint_handler(int sig) {
-  FLOGINFO("handling signal %d", sig);
-  // get pid of current fg job
-  pid_t pid = fgpid(jobs);
-  // if no such job, silently return early
-  if (!pid) {
-    printf("no foreground job exists\n");
-    return;
-  }
-  // otherwise send kill signal to process group
-  FLOGINFO("fg job (%d) found, forwarding signal to child group...", pid);
-  if (kill(-pid, SIGINT) < 0)
-    printf("Interrupt error: failed to kill %d\n", pid);
+int signum(const char *name) {
+  static const struct {
+    const char *name;
+    int num;
+  } signames[] = {{"HUP", SIGHUP},   {"INT", SIGINT},   {"QUIT", SIGQUIT},
+                  {"KILL", SIGKILL}, {"USR1", SIGUSR1}, {"USR2", SIGUSR2},
+                  {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+                  {"STOP", SIGSTOP}, {"TSTP", SIGTSTP}, {"TTIN", SIGTTIN},
+                  {"TTOU", SIGTTOU}, {"WINCH", SIGWINCH}};
+  char *endptr;
+
+  long n = strtol(name, &endptr, 10);
+  if (*name && *endptr == '\0')
+    return n > 0 && n < NSIG ? n : -1;
+  if (strncmp(name, "SIG", 3) == 0)
+    name += 3;
+  for (size_t i = 0; i < sizeof(signames) / sizeof(signames[0]); i++)
+    if (strcasecmp(name, signames[i].name) == 0)
+      return signames[i].num;
+  return -1;
 }
 
 /*
- * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
- *     the user types ctrl-z at the keyboard. Catch it and suspend the
- *     foreground job by sending it a SIGTSTP.
+ * do_tag - Execute the builtin tag command, tag [-d] jobspec... tag, which
+ *    adds tag to (or w/ -d, removes it from) each matching job, so @tag
+ *    job specs select them.
  */
-void sigtstp_handler(int sig) {
-  FLOGINFO("handling signal %d", sig);
-  // get current fg job pid
-  pid_t pid = fgpid(jobs);
-  // if no such job, silently return early
-  if (!pid) {
-    printf("no foreground job exists\n");
+void do_tag(int argc, char **argv) {
+  int del = argc > 1 && strcmp(argv[1], "-d") == 0;
+  char *tag = argv[argc - 1];
+  size_t len = strlen(tag);
+
+  if (argc < 3 + del || len == 0 || strchr(tag, ' ') || tag[0] == '%' ||
+      tag[0] == '@') {
+    fprintf(stderr, "usage: tag [-d] jobspec... tag\n");
+    last_status = 1;
     return;
   }
-  // else stop job by forwarding the signal
-  FLOGINFO("fg job (%d) found, forwarding signal to child group...", pid);
-  if (kill(-pid, SIGTSTP) < 0)
-    printf("Stop error: failed to stop %d\n", pid);
-}
-
-/*********************
- * End signal handlers
- *********************/
 
-/***********************************************
- * Helper routines that manipulate the job list
- **********************************************/
+  struct job_t *sel[MAXJOBS];
+  int n = selectjobs(argv[0], argc - 2 - del, argv + 1 + del, sel);
+  for (int i = 0; i < n; i++) {
+    char *tags = sel[i]->tags;
+    size_t tlen = strlen(tags);
 
-/* clearjob - Clear the entries in a job struct */
-void clearjob(struct job_t *job) {
-  job->pid = 0;
-  job->jid = 0;
-  job->state = UNDEF;
-  job->cmdline[0] = '\0';
+    if (del) { // cut tag & its separating space out
+      char *t = tags;
+      while ((t = strstr(t, tag)) &&
+             !((t == tags || t[-1] == ' ') && (t[len] == ' ' || !t[len])))
+        t++;
+      if (t) {
+        size_t cut = len + (t[len] == ' ');
+        if (!t[len] && t > tags) // last tag: take the space before it
+          t--, cut++;
+        memmove(t, t + cut, tags + tlen + 1 - (t + cut));
+      }
+    } else if (!hastag(sel[i], tag, len)) {
+      if (tlen + len + 2 > MAXTAGS) {
+        fprintf(stderr, "tag: too many tags for job [%d]\n", sel[i]->jid);
+        last_status = 1;
+        continue;
+      }
+      sprintf(tags + tlen, tlen ? " %s" : "%s", tag);
+    }
+  }
 }
 
-/* initjobs - Initialize the job list */
-void initjobs(struct job_t *jobs) {
-  int i;
+/*
+ * do_echo - Execute the builtin echo command, printing its args separated
+ *    by spaces. A leading -n suppresses the trailing newline.
+ */
+void do_echo(int argc, char **argv) {
+  int newline = 1;
+  int i = 1;
 
-  for (i = 0; i < MAXJOBS; i++)
-    clearjob(&jobs[i]);
+  if (argc > 1 && strcmp("-n", argv[1]) == 0) {
+    newline = 0;
+    i++;
+  }
+  for (; i < argc; i++)
+    printf(i < argc - 1 ? "%s " : "%s", argv[i]);
+  if (newline)
+    printf("\n");
 }
 
-/* maxjid - Returns largest allocated job ID */
-int maxjid(struct job_t *jobs) {
-  int i, max = 0;
+/*
+ * do_printf - Execute the builtin printf command. Supports the \n, \t &
+ *    \\ escapes & %s, %d, %i, %u, %x, %X, %o & %c conversions with the
+ *    usual flags/width/precision. As in other shells, the format is reused
+ *    until all args are consumed, & missing args print as "" or 0.
+ */
+void do_printf(int argc, char **argv) {
+  if (argc < 2) {
+    fprintf(stderr, "printf: usage: printf format [arguments]\n");
+    last_status = 1;
+    return;
+  }
 
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid > max)
-      max = jobs[i].jid;
-  return max;
-}
+  char *fmt = argv[1];
+  int arg = 2; // next arg to convert
 
-/* addjob - Add a job to the job list */
-int addjob(struct job_t *jobs, pid_t pid, int state, char *cmdline) {
-  int i;
+  do {
+    for (char *c = fmt; *c; c++) {
+      if (*c == '\\' && c[1]) { // escapes
+        c++;
+        putchar(*c == 'n' ? '\n' : *c == 't' ? '\t' : *c);
+        continue;
+      }
+      if (*c != '%') {
+        putchar(*c);
+        continue;
+      }
+      if (c[1] == '%') {
+        putchar('%');
+        c++;
+        continue;
+      }
 
-  if (pid < 1) {
-    fprintf(stderr, "Unable to create job for pid %d", pid);
-    return 0;
-  }
+      // copy the conversion spec so it can be handed to printf
+      char spec[32];
+      size_t n = strspn(c + 1, "-+ #0123456789.") + 1;
+      if (n > sizeof(spec) - 3 || !c[n]) {
+        fprintf(stderr, "printf: invalid format: %s\n", c);
+        last_status = 1;
+        return;
+      }
+      memcpy(spec, c, n);
+      char conv = c[n];
+      c += n;
 
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == 0) {
-      jobs[i].pid = pid;
-      jobs[i].state = state;
-      jobs[i].jid = nextjid++;
-      if (nextjid > MAXJOBS)
-        nextjid = 1;
-      strcpy(jobs[i].cmdline, cmdline);
-      if (verbose) {
-        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid,
-               jobs[i].cmdline);
+      char *val = arg < argc ? argv[arg++] : NULL;
+      if (conv == 's') {
+        spec[n] = 's';
+        spec[n + 1] = '\0';
+        printf(spec, val ? val : "");
+      } else if (conv == 'c') {
+        spec[n] = 'c';
+        spec[n + 1] = '\0';
+        if (val && *val) // missing args print nothing
+          printf(spec, *val);
+      } else if (strchr("diuxXo", conv)) {
+        spec[n] = 'l'; // parse all numbers as longs
+        spec[n + 1] = conv;
+        spec[n + 2] = '\0';
+        printf(spec, val ? strtol(val, NULL, 0) : 0L);
+      } else {
+        fprintf(stderr, "printf: %%%c: invalid conversion\n", conv);
+        last_status = 1;
+        return;
       }
-      return 1;
     }
-  }
-
-  fprintf(stderr, "Tried to create too many jobs\n");
-  return 0;
+  } while (arg < argc && arg > 2); // stop if format consumed no args
 }
 
-/* deletejob - Delete a job whose PID=pid from the job list */
-int deletejob(struct job_t *jobs, pid_t pid) {
-  FLOGINFO("delete requested for job(%d)", pid);
-  int i;
+/*
+ * do_export - Execute the builtin export command, marking each NAME (or
+ *    NAME=value, which also sets it) as passed on to jobs. With no args,
+ *    lists the exported variables.
+ */
+void do_export(int argc, char **argv) {
+  if (argc == 1) {
+    char **env = getenvp();
+    for (int i = 0; env[i]; i++)
+      printf("export %s\n", env[i]);
+    return;
+  }
 
-  if (pid < 1)
-    return 0;
+  for (int i = 1; i < argc; i++) {
+    char *eq = strchr(argv[i], '=');
+    size_t nlen = eq ? (size_t)(eq - argv[i]) : strlen(argv[i]);
+    char *val = eq ? eq + 1 : getvar(argv[i], nlen);
 
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid == pid) {
-      struct job_t job = jobs[i];
-      FLOGINFO("[%d] (%d) %s: job found, deleting", job.jid, job.pid,
-               job.cmdline);
-      clearjob(&jobs[i]);
-      nextjid = maxjid(jobs) + 1;
-      LOGINFO("job deleted");
-      return 1;
+    if (setvar(argv[i], nlen, val ? val : "", 1) < 0) {
+      fprintf(stderr, "export: %s: not a valid identifier\n", argv[i]);
+      last_status = 1;
     }
   }
-  return 0;
 }
 
-/* fgpid - Return PID of current foreground job, 0 if no such job */
-pid_t fgpid(struct job_t *jobs) {
-  int i;
+/*
+ * do_jobslots - Execute the builtin jobslots command, printing the limit
+ *    of jobs running at once, or setting it & launching any queued jobs
+ *    that now fit.
+ */
+void do_jobslots(int argc, char **argv) {
+  if (argc == 1) {
+    printf("%d\n", jobslots);
+    return;
+  }
+
+  char *endptr;
+  long n = strtol(argv[1], &endptr, 10);
+  if (argc != 2 || *endptr != '\0' || n < 1 || n > MAXJOBS) {
+    fprintf(stderr, "jobslots: argument must be a number from 1 to %d\n",
+            MAXJOBS);
+    last_status = 1;
+    return;
+  }
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  jobslots = n;
+  launchqueued();
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * do_parallel - Execute the builtin parallel command,
+ *        parallel [-j K] [-t] cmd [args...] [::: inputs...]
+ *    which runs "cmd args input" as a bg job for each input, with at most
+ *    K (default jobslots) running at once, starting the next as soon as
+ *    one exits. W/o ":::", inputs are read from stdin, one per line, up to
+ *    EOF. -t prefixes each line of a job's output w/ its input. Waits for
+ *    all jobs, then reports failed jobs & the wall time. last_status is
+ *    the number of failed jobs, up to 101.
+ */
+void do_parallel(int argc, char **argv) {
+  int nslots = jobslots, tagged = 0, i;
+  int cmdstart, cmdend, ninputs;
+  char **inputs;     // input for each job
+  char **lines = NULL; // inputs read from stdin, to free
+  char *endptr;
+
+  for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+    if (strcmp(argv[i], "-t") == 0) {
+      tagged = 1;
+    } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+      nslots = strtol(argv[++i], &endptr, 10);
+      if (*endptr != '\0' || nslots < 1 || nslots > MAXJOBS) {
+        fprintf(stderr, "parallel: -j must be a number from 1 to %d\n",
+                MAXJOBS);
+        last_status = 1;
+        return;
+      }
+    } else {
+      break;
+    }
+  }
+  cmdstart = i;
+  for (cmdend = cmdstart; cmdend < argc; cmdend++)
+    if (strcmp(argv[cmdend], ":::") == 0)
+      break;
+  if (cmdstart == cmdend) {
+    fprintf(stderr, "usage: parallel [-j K] [-t] cmd [args...] "
+                    "[::: inputs...]\n");
+    last_status = 1;
+    return;
+  }
+
+  if (cmdend < argc) { // inputs on the command line
+    inputs = argv + cmdend + 1;
+    ninputs = argc - cmdend - 1;
+  } else { // inputs from stdin, 1 per line
+    inputs = lines = readlines(stdin, &ninputs);
+  }
+  if (nslots > ninputs)
+    nslots = ninputs ? ninputs : 1;
+
+  struct parallel_t run;
+  run.nslots = nslots;
+  run.running = 0;
+  run.pids = calloc(nslots, sizeof(pid_t));
+  run.inputs = calloc(nslots, sizeof(int));
+  run.status = calloc(ninputs ? ninputs : 1, sizeof(int));
+  if (!run.pids || !run.inputs || !run.status)
+    unix_error("parallel error");
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  // launch jobs w/ SIGCHLD blocked, so each exit is seen by sigsuspend
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  parallel = &run;
+
+  int next = 0; // next input to launch
+  while ((next < ninputs && !interrupted) || run.running > 0) {
+    int throttled = 0; // waiting on the launch rate limit
+    while (run.running < nslots && next < ninputs && !interrupted) {
+      if (!taketoken()) {
+        armtimer(tokenwait());
+        throttled = 1;
+        break;
+      }
+      char *args[MAXARGS + 1];
+      char cmdline[MAXLINE];
+      int nargs = 0;
+      size_t len = 0;
+
+      for (i = cmdstart; i < cmdend && nargs < MAXARGS; i++)
+        args[nargs++] = argv[i];
+      args[nargs++] = inputs[next];
+      for (i = 0; i < nargs && len < MAXLINE - 2; i++)
+        len += snprintf(cmdline + len, MAXLINE - 1 - len, i ? " %s" : "%s",
+                        args[i]);
+      strcpy(cmdline + (len < MAXLINE - 2 ? len : MAXLINE - 2), "\n");
+
+      struct job_t *job = queuejob(cmdline, NULL, 0, args, nargs);
+      if (job)
+        job->tagged = tagged;
+      if (!job || !startjob(job, BG)) {
+        if (job)
+          clearjob(job);
+        run.status[next++] = 127; // couldn't launch
+        continue;
+      }
+
+      for (i = 0; run.pids[i]; i++) // find a free slot
+        ;
+      run.pids[i] = job->pid;
+      run.inputs[i] = next++;
+      run.running++;
+    }
+    if (run.running > 0 || throttled)
+      idlewait(&prev_sigset); // wait for a job to exit, or a token
+  }
+
+  parallel = NULL;
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  int failed = 0;
+  for (i = 0; i < next; i++)
+    if (run.status[i]) {
+      printf("parallel: %s failed with status %d\n", inputs[i],
+             run.status[i]);
+      failed++;
+    }
+  printf("parallel: %d jobs, %d failed, %d not run, %.3fs\n", next, failed,
+         ninputs - next,
+         (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+  last_status = failed > 101 ? 101 : failed;
+
+  free(run.pids);
+  free(run.inputs);
+  free(run.status);
+  for (i = 0; lines && i < ninputs; i++)
+    free(lines[i]);
+  free(lines);
+}
+
+/*
+ * readlines - Read lines from f up to EOF, w/o their newlines, skipping
+ *    blank ones. Returns a malloc'd array of malloc'd lines & their count
+ *    in n. Clears EOF after, so a tty's ctrl-d doesn't also end the shell.
+ */
+char **readlines(FILE *f, int *n) {
+  char line[MAXLINE];
+  char **lines = NULL;
+  int cap = 0;
+
+  *n = 0;
+  while (fgets(line, MAXLINE, f)) {
+    line[strcspn(line, "\n")] = '\0';
+    if (line[0] == '\0')
+      continue;
+    if (*n == cap) {
+      cap = cap ? cap * 2 : 16;
+      lines = realloc(lines, cap * sizeof(char *));
+      if (!lines)
+        unix_error("readlines error");
+    }
+    if (!(lines[(*n)++] = strdup(line)))
+      unix_error("readlines error");
+  }
+  clearerr(f);
+  return lines;
+}
+
+/*
+ * do_batch - Execute the builtin batch command,
+ *        batch [-j K] [-n N] [-f file] cmd [args...]
+ *    which reads items, one per line, from file or stdin, & runs
+ *    "cmd args items..." as bg jobs, packing as many items into each job
+ *    as fit in ARG_MAX (w/ room for the env), or at most N. At most K
+ *    (default jobslots) jobs run at once. Waits for all jobs, then reports
+ *    failed batches & items/sec. last_status is 123 if any batch failed,
+ *    as w/ xargs.
+ */
+void do_batch(int argc, char **argv) {
+  int nslots = jobslots, nitems, i;
+  long maxitems = 0; // the item count & ARG_MAX bound it anyway
+  char *path = NULL, *endptr;
+  FILE *f = stdin;
+
+  for (i = 1; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    long n = strtol(argv[i + 1], &endptr, 10);
+    if (strcmp(argv[i], "-f") == 0) {
+      path = argv[i + 1];
+    } else if ((strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "-n") == 0) &&
+               *endptr == '\0' && n >= 1) {
+      if (argv[i][1] == 'j')
+        nslots = n < MAXJOBS ? n : MAXJOBS;
+      else
+        maxitems = n;
+    } else {
+      break;
+    }
+  }
+  if (i >= argc || argv[i][0] == '-') {
+    fprintf(stderr, "usage: batch [-j K] [-n N] [-f file] cmd [args...]\n");
+    last_status = 1;
+    return;
+  }
+  int cmdstart = i, ncmd = argc - i;
+
+  if (path && !(f = fopen(path, "r"))) {
+    fprintf(stderr, "batch: %s: %s\n", path, strerror(errno));
+    last_status = 1;
+    return;
+  }
+  char **items = readlines(f, &nitems);
+  if (path)
+    fclose(f);
+
+  // budget for each job's args: ARG_MAX, less the env & cmd args & some
+  // headroom, as xargs does
+  char **env = getenvp();
+  long budget = sysconf(_SC_ARG_MAX) - 2048;
+  for (char **e = env; *e; e++)
+    budget -= strlen(*e) + 1 + sizeof(char *);
+  for (i = cmdstart; i < argc; i++)
+    budget -= strlen(argv[i]) + 1 + sizeof(char *);
+
+  // split items into batches, each the items from its start to the next's
+  int *starts = malloc((nitems + 1) * sizeof(int));
+  int nbatches = 0;
+  if (!starts)
+    unix_error("batch error");
+  for (int item = 0; item < nitems; nbatches++) {
+    long left = budget;
+    starts[nbatches] = item;
+    do
+      left -= strlen(items[item++]) + 1 + sizeof(char *);
+    while (item < nitems && left - (long)strlen(items[item]) - 1 -
+                                    (long)sizeof(char *) >= 0 &&
+           (!maxitems || item - starts[nbatches] < maxitems));
+  }
+  starts[nbatches] = nitems;
+  if (nslots > nbatches)
+    nslots = nbatches ? nbatches : 1;
+
+  struct parallel_t run; // batches finish like parallel's jobs
+  run.nslots = nslots;
+  run.running = 0;
+  run.pids = calloc(nslots, sizeof(pid_t));
+  run.inputs = calloc(nslots, sizeof(int));
+  run.status = calloc(nbatches ? nbatches : 1, sizeof(int));
+  char **args = malloc((ncmd + nitems + 1) * sizeof(char *));
+  if (!run.pids || !run.inputs || !run.status || !args)
+    unix_error("batch error");
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  parallel = &run;
+
+  int next = 0; // next batch to launch
+  while ((next < nbatches && !interrupted) || run.running > 0) {
+    int throttled = 0; // waiting on the launch rate limit
+    while (run.running < nslots && next < nbatches && !interrupted) {
+      if (!taketoken()) {
+        armtimer(tokenwait());
+        throttled = 1;
+        break;
+      }
+
+      // args are too many for a job's saved args, so fork here
+      int n = starts[next + 1] - starts[next];
+      memcpy(args, argv + cmdstart, ncmd * sizeof(char *));
+      memcpy(args + ncmd, items + starts[next], n * sizeof(char *));
+      args[ncmd + n] = NULL;
+
+      char cmdline[MAXLINE];
+      size_t len = 0;
+      for (i = 0; i < ncmd + 1 && len < MAXLINE - 32; i++)
+        len += snprintf(cmdline + len, MAXLINE - 32 - len, i ? " %s" : "%s",
+                        args[i]);
+      if (len > MAXLINE - 32)
+        len = MAXLINE - 32;
+      snprintf(cmdline + len, MAXLINE - len, n > 1 ? " (+%d more)\n" : "\n",
+               n - 1);
+
+      // reserve the job's slot first, so a full job list forks nothing
+      struct job_t *job = addjob(jobs, 0, QU, cmdline);
+      forkat = nowns();
+      pid_t pid = job ? fork() : -1;
+      if (pid == 0)
+        execjob(args, env, NULL, 0, 0, NULL);
+      if (pid < 0) {
+        if (job)
+          clearjob(job);
+        run.status[next++] = 127; // couldn't launch
+        continue;
+      }
+      histadd(H_FORK, nowns() - forkat);
+      setpgid(pid, pid); // as in the child
+      PROBE3(job_spawn, pid, cmdline, 0);
+      job->pid = pid;
+      job->state = BG;
+
+      for (i = 0; run.pids[i]; i++) // find a free slot
+        ;
+      run.pids[i] = pid;
+      run.inputs[i] = next++;
+      run.running++;
+    }
+    if (run.running > 0 || throttled)
+      idlewait(&prev_sigset); // wait for a job to exit, or a token
+  }
+
+  parallel = NULL;
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  int failed = 0, done = 0;
+  for (i = 0; i < next; i++) {
+    done += starts[i + 1] - starts[i];
+    if (run.status[i]) {
+      printf("batch: items %d-%d failed with status %d\n", starts[i] + 1,
+             starts[i + 1], run.status[i]);
+      failed++;
+    }
+  }
+  double secs =
+      (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("batch: %d items in %d jobs, %d failed, %d items not run, %.3fs, "
+         "%.0f items/s\n",
+         done, next, failed, nitems - done, secs, secs > 0 ? done / secs : 0);
+  last_status = failed ? 123 : 0;
+
+  free(run.pids);
+  free(run.inputs);
+  free(run.status);
+  free(args);
+  free(starts);
+  for (i = 0; i < nitems; i++)
+    free(items[i]);
+  free(items);
+}
+
+/*
+ * do_after - Execute the builtin after command,
+ *        after [-s] %jid... -- cmd [args...]
+ *    which adds cmd as a bg job that's blocked until all the given jobs
+ *    exit, then queued to launch like any other bg job. W/ -s, it's
+ *    cancelled instead if any of them fails.
+ */
+void do_after(int argc, char **argv) {
+  int deps[MAXDEPS], ndeps = 0, needok = 0, i = 1;
+  char *endptr;
+
+  if (i < argc && strcmp(argv[i], "-s") == 0) {
+    needok = 1;
+    i++;
+  }
+  for (; i < argc && strcmp(argv[i], "--") != 0; i++) {
+    long jid = strtol(argv[i] + 1, &endptr, 10);
+    if (argv[i][0] != '%' || *endptr != '\0' || ndeps == MAXDEPS) {
+      fprintf(stderr, "after: arguments must be up to %d %%jobids\n",
+              MAXDEPS);
+      last_status = 1;
+      return;
+    }
+    deps[ndeps++] = jid;
+  }
+  if (i + 1 >= argc) {
+    fprintf(stderr, "usage: after [-s] %%jobid... -- cmd [args...]\n");
+    last_status = 1;
+    return;
+  }
+  i++; // skip "--"
+
+  char cmdline[MAXLINE];
+  size_t len = 0;
+  int nassign = 0;
+  for (int j = i; j < argc && len < MAXLINE - 2; j++)
+    len += snprintf(cmdline + len, MAXLINE - 1 - len, j > i ? " %s" : "%s",
+                    argv[j]);
+  strcpy(cmdline + (len < MAXLINE - 2 ? len : MAXLINE - 2), "\n");
+  while (i + nassign < argc - 1 && isassign(argv[i + nassign]))
+    nassign++;
+
+  // block SIGCHLD so the jobs waited on can't exit before they're recorded
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  for (int j = 0; j < ndeps; j++)
+    if (!getjobjid(jobs, deps[j])) {
+      fprintf(stderr, "%%%d: No such job\n", deps[j]);
+      sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+      last_status = 1;
+      return;
+    }
+
+  struct job_t *job = queuejob(cmdline, argv + i, nassign, argv + i + nassign,
+                               argc - i - nassign);
+  if (job) {
+    memcpy(job->deps, deps, sizeof(deps));
+    job->ndeps = ndeps;
+    job->needok = needok;
+    job->state = ndeps ? BL : QU;
+    printf("[%d] %s %s", job->jid, ndeps ? "Blocked" : "Queued",
+           job->cmdline);
+    launchqueued();
+  }
+
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  last_status = !job;
+}
+
+/*
+ * do_supervise - Execute the builtin supervise command,
+ *        supervise [-n N] cmd [args...]
+ *    which runs cmd as a bg job that's restarted, keeping its JID, each
+ *    time it exits, unless killed by ctrl-c (SIGINT). Quick exits back
+ *    off, & after N (default MAXCRASHES) in a row it's given up on.
+ */
+void do_supervise(int argc, char **argv) {
+  int maxcrashes = MAXCRASHES, i = 1;
+  char *endptr;
+
+  if (i + 1 < argc && strcmp(argv[i], "-n") == 0) {
+    maxcrashes = strtol(argv[i + 1], &endptr, 10);
+    if (*endptr != '\0' || maxcrashes < 0) {
+      fprintf(stderr, "supervise: -n must be a number 0 or more\n");
+      last_status = 1;
+      return;
+    }
+    i += 2;
+  }
+  if (i >= argc) {
+    fprintf(stderr, "usage: supervise [-n N] cmd [args...]\n");
+    last_status = 1;
+    return;
+  }
+
+  char cmdline[MAXLINE];
+  size_t len = 0;
+  int nassign = 0;
+  for (int j = i; j < argc && len < MAXLINE - 2; j++)
+    len += snprintf(cmdline + len, MAXLINE - 1 - len, j > i ? " %s" : "%s",
+                    argv[j]);
+  strcpy(cmdline + (len < MAXLINE - 2 ? len : MAXLINE - 2), "\n");
+  while (i + nassign < argc - 1 && isassign(argv[i + nassign]))
+    nassign++;
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  struct job_t *job = queuejob(cmdline, argv + i, nassign, argv + i + nassign,
+                               argc - i - nassign);
+  if (job) {
+    job->supervised = 1;
+    job->maxcrashes = maxcrashes;
+    job->crashes = 0;
+    job->restarts = 0;
+    launchqueued();
+    if (job->pid)
+      printf("[%d] (%d) %s", job->jid, job->pid, job->cmdline);
+    else
+      printf("[%d] Queued %s", job->jid, job->cmdline);
+  }
+
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  last_status = !job;
+}
+
+/*
+ * do_launchrate - Execute the builtin launchrate command,
+ *        launchrate [rate [burst] | off]
+ *    which sets a limit of rate bg job launches per sec, allowing bursts
+ *    of up to burst (default 1) launches at once. Launches over the limit
+ *    are queued until there's a token. W/o args, prints the limit & how
+ *    many launches were deferred & how long they waited on average.
+ */
+void do_launchrate(int argc, char **argv) {
+  if (argc == 1) {
+    if (ratelimit.rate > 0)
+      printf("rate %g/s, burst %g\n", ratelimit.rate, ratelimit.burst);
+    else
+      printf("rate unlimited\n");
+    printf("%lu deferred, avg wait %.3fs\n", ratelimit.deferred,
+           ratelimit.launched ? ratelimit.waited / ratelimit.launched : 0);
+    return;
+  }
+
+  double rate = 0, burst = 1;
+  char *endptr = "";
+  if (strcmp(argv[1], "off") != 0) {
+    rate = strtod(argv[1], &endptr);
+    if (*endptr == '\0' && argc > 2)
+      burst = strtod(argv[2], &endptr);
+  }
+  if (*endptr != '\0' || argc > 3 || rate < 0 || burst < 1) {
+    fprintf(stderr, "usage: launchrate [rate [burst] | off]\n");
+    last_status = 1;
+    return;
+  }
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  ratelimit.rate = rate;
+  ratelimit.burst = burst;
+  ratelimit.tokens = burst; // start w/ a full bucket
+  clock_gettime(CLOCK_MONOTONIC, &ratelimit.last);
+  launchqueued(); // in case the limit was raised
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * do_dedup - Execute the builtin dedup command, dedup [on | off], which
+ *    turns attaching bg jobs to identical running or queued jobs (same
+ *    args, directory & exported env) on or off. W/o args, prints whether
+ *    it's on & how many forks it saved.
+ */
+void do_dedup(int argc, char **argv) {
+  if (argc == 1)
+    printf("dedup %s, %lu forks saved\n", dedup.on ? "on" : "off",
+           dedup.saved);
+  else if (argc == 2 && strcmp(argv[1], "on") == 0)
+    dedup.on = 1;
+  else if (argc == 2 && strcmp(argv[1], "off") == 0)
+    dedup.on = 0;
+  else {
+    fprintf(stderr, "usage: dedup [on | off]\n");
+    last_status = 1;
+  }
+}
+
+/*
+ * do_wait - Execute the builtin wait command, wait [jobspec...],
+ *    which waits for the given jobs to exit (or stop), & sets last_status
+ *    to the exit status of the last one. W/o args, waits for all running,
+ *    queued & blocked jobs except supervised ones, & sets it to 0. Jobs
+ *    attached to by dedup share the status of the job they attached to.
+ */
+void do_wait(int argc, char **argv) {
+  unsigned long seqs[MAXJOBS]; // seqs of jobs to wait for, one per job
+  int nseqs = 0;
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  if (argc > 1) {
+    struct job_t *sel[MAXJOBS];
+    last_status = 0;
+    int n = selectjobs(argv[0], argc - 1, argv + 1, sel);
+    if (last_status) // some spec matched no job
+      last_status = 127;
+    for (int i = 0; i < n; i++)
+      seqs[nseqs++] = sel[i]->seq;
+  } else
+    for (int i = 0; i < MAXJOBS; i++)
+      if ((jobs[i].state == BG || jobs[i].state == QU ||
+           jobs[i].state == BL) &&
+          !jobs[i].supervised)
+        seqs[nseqs++] = jobs[i].seq;
+
+  for (int i = 0; i < nseqs && !interrupted; i++) {
+    struct job_t *job;
+    while (1) { // sigchld_handler updates the job list while suspended
+      job = NULL;
+      for (int j = 0; j < MAXJOBS && !job; j++)
+        if (jobs[j].jid && jobs[j].seq == seqs[i])
+          job = &jobs[j];
+      if (!job || job->state == ST || interrupted)
+        break;
+      idlewait(&prev_sigset);
+    }
+
+    if (argc > 1 && !interrupted) {
+      int status = job ? exitcode(job->wstatus) : donestatus(seqs[i]);
+      last_status = status < 0 ? 127 : status;
+    }
+  }
+  if (interrupted)
+    last_status = 128 + SIGINT;
+
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * waitfg - Block until process pid is no longer the foreground process,
+ *    returning its exit status (128 + signal number if it was killed or
+ *    stopped by a signal, as in other shells)
+ */
+int waitfg(pid_t pid) {
+  sigset_t mask_sigchld, prev_mask, wait_mask;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_mask); // check job list safely
+  wait_mask = prev_mask; // & allow receiving of all signals while waiting
+  sigdelset(&wait_mask, SIGCHLD);
+  PROBE1(fg_wait_begin, pid);
+
+  int waiting = 1; // init waiting to True
+
+  while (waiting) {
+    struct job_t *job = getjobpid(jobs, pid); // check if still waiting
+    waiting = (job && job->state == FG) ? 1 : 0;
+
+    if (waiting) // suspend until a signal is received
+      idlewait(&wait_mask);
+    // NOTE: all actual signal handling will be done in sig handlers,
+    //       including updating job status on appropriate signals
+  }
+  if (fgleftat) { // time from the reap to here
+    histadd(H_WAKEUP, nowns() - fgleftat);
+    fgleftat = 0;
+  }
+  giveterm(shell_pgid); // job is done or stopped, take tty back
+  sigprocmask(SIG_SETMASK, &prev_mask,
+              NULL); // when done waiting, restore previous mask
+
+  PROBE2(fg_wait_end, pid, fg_status);
+  return fg_status; // set by sigchld_handler when job left the fg
+}
+
+/*
+ * initterm - Put tsh in its own process group in the foreground of the
+ *    controlling terminal, so that giveterm() can later hand the tty to
+ *    foreground jobs & keyboard signals go straight to them. If tsh is in
+ *    the background, it stops until it's brought to the foreground, or
+ *    w/o block just leaves the tty alone.
+ */
+void initterm(int block) {
+  // wait until we're in the foreground before grabbing the tty
+  while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+    if (!block)
+      return;
+    kill(-shell_pgid, SIGTTIN);
+  }
+
+  // tcsetpgrp from a background group raises SIGTTOU, which tsh must
+  // survive when taking the tty back from a job
+  Signal(SIGTTOU, SIG_IGN);
+
+  shell_pgid = getpid();
+  if (setpgid(shell_pgid, shell_pgid) < 0 && errno != EPERM) {
+    LOGWARN("unable to put tsh in its own process group");
+    return;
+  }
+  shell_pgid = getpgrp();
+  if (tcsetpgrp(STDIN_FILENO, shell_pgid) < 0) {
+    LOGWARN("unable to take control of terminal");
+    return;
+  }
+  tcgetattr(STDIN_FILENO, &shell_tmodes);
+
+  interactive = 1;
+  FLOGINFO("tsh owns terminal as process group %d", shell_pgid);
+}
+
+/*
+ * giveterm - Make process group pgid the foreground group of the terminal.
+ *    Handing it back to tsh also restores tsh's saved tty modes. No-op
+ *    when tsh isn't running interactively on a terminal.
+ */
+void giveterm(pid_t pgid) {
+  if (!interactive)
+    return;
+
+  if (tcsetpgrp(STDIN_FILENO, pgid) < 0)
+    FLOGWARN("unable to give terminal to process group %d", pgid);
+  if (pgid == shell_pgid)
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+}
+
+/*****************
+ * Signal handlers
+ *****************/
+
+/*
+ * sigchld_handler - The kernel sends a SIGCHLD to the shell whenever
+ *     a child job terminates (becomes a zombie), or stops because it
+ *     received a SIGSTOP or SIGTSTP signal. The handler reaps all
+ *     available zombie children, but doesn't wait for any other
+ *     currently running children to terminate. Queued jobs are launched
+ *     into any job slots that frees up, right away if tsh is idle or else
+ *     once it next goes idle (see setidle).
+ */
+void sigchld_handler(int _) {
+  LOGINFO("SIGCHLD caught, handling...");
+  int pid;                           // to store pid of changed child proc
+  int status;                        // to store child proc status
+  struct rusage ru;                  // to store child proc resource usage
+  sigset_t mask_sigall, prev_sigset; // signal set masks
+  unsigned long t0 = nowns(), nreaped = 0;
+  int reapedfg = 0;
+
+  // block all signals while handline sigchld
+  sigfillset(&mask_sigall);
+  sigprocmask(SIG_BLOCK, &mask_sigall, &prev_sigset);
+
+  // reap and update ALL children necessary
+  while ((pid = wait4(-1,           // wait for ANY child to term/stop
+                      &status,      // save status here
+                      WNOHANG |     // poll instead of blocking
+                          WUNTRACED, // get stopped jobs too, not just termed
+                      &ru            // & resources used, if termed
+                      )) > 0) {
+    FLOGINFO("Child proc (%d) changed, checking status...", pid);
+    nreaped++;
+    if (pid == fgpid(jobs)) { // for waitfg's wakeup time
+      fgleftat = t0;
+      reapedfg = 1;
+    }
+
+    // handle the following cases:
+    // 1. child termed due to exit
+    if (WIFEXITED(status)) {
+      LOGINFO("process exited, requesting deletion...");
+      if (pid == fgpid(jobs)) // save exit status for waitfg
+        fg_status = WEXITSTATUS(status);
+      struct job_t *job = getjobpid(jobs, pid);
+      if (job)
+        jobexited(job, status, &ru);
+      deletejob(jobs, pid); // then remove from jobs list
+      continue;             // & move on to the next child
+    }
+
+    // 2. child termed due to signal
+    if (WIFSIGNALED(status)) {
+      int sig = WTERMSIG(status);
+      if (pid == fgpid(jobs)) { // save exit status for waitfg
+        fg_status = 128 + sig;
+        interrupted |= sig == SIGINT; // & stop running the command line
+      }
+      struct job_t *job = getjobpid(jobs, pid); // get job data
+      if (!job) { // not one of ours, so nothing to update
+        FLOGERR("error terminating job, no job found for pid (%d)", pid);
+        continue;
+      }
+      int jid = job->jid;
+      jobexited(job, status, &ru);
+      deletejob(jobs, pid); // then remove from jobs list
+      printf("Job [%d] (%d) terminated by signal %d\n", jid, pid,
+             sig); // & print confirmation
+      continue;    // & move on to the next child
+    }
+
+    // 3. child stopped due to signal
+    if (WIFSTOPPED(status)) {
+      int sig = WSTOPSIG(status);
+      FLOGINFO("process  stopped due to signal %d", sig);
+      if (pid == fgpid(jobs)) // save exit status for waitfg
+        fg_status = 128 + sig;
+      struct job_t *job = getjobpid(jobs, pid); // get job data
+      if (!job) { // not one of ours, so nothing to update
+        FLOGERR("error updating job, no job found for pid (%d)", pid);
+        continue;
+      }
+      job->state = ST; // update state to Stopped
+      job->wstatus = status;
+      job->touched = ++jobclock;
+      PROBE3(job_stop, job->jid, pid, sig);
+      printf("Job [%d] (%d) stopped by signal %d\n", job->jid, pid,
+             sig); // & print confirmation
+      continue;    // & move on to the next child
+    }
+
+    // ERROR -- if this point is reached, then something has gone wrong
+    sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
+    unix_error("Unhandled SIGCHLD received, unable to continue."); // exit
+  }
+
+  if (idle) // fill any job slots freed above
+    pumpjobs();
+  else
+    pumpdue = 1;
+  if (nreaped) {
+    histadd(H_BATCH, nreaped);
+    histadd(H_REAP, nowns() - t0);
+  }
+  if (reapedfg)
+    phase(P_REAP, t0);
+
+  // handler done, cleanup
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL); // restore signal mask
+}
+
+/*
+ * sigalrm_handler - The retry timer went off, see armtimer.
+ *    Entries are launched via sigchld_handler, which knows when it's safe
+ *    to launch jobs, so just send tsh a SIGCHLD.
+ */
+void sigalrm_handler(int sig) { kill(getpid(), SIGCHLD); }
+
+/*
+ * sigint_handler - The kernel sends a SIGINT to the shell whenever the
+ *    user types ctrl-c at the keyboard. Catch it and send it along
+ *    to the foreground job. When tsh owns a terminal, the fg job holds
+ *    the tty & gets ctrl-c directly, so this only forwards signals sent
+ *    to tsh itself (e.g. by the driver in -p mode).
+ */
+void sigint_handler(int sig) {
+  unsigned long t0 = nowns();
+  FLOGINFO("handling signal %d", sig);
+  // get pid of current fg job
+  pid_t pid = fgpid(jobs);
+  // if no such job, silently return early
+  if (!pid) {
+    printf("no foreground job exists\n");
+    interrupted = 1; // still stop a wait builtin or command list
+    return;
+  }
+  // otherwise send kill signal to process group
+  FLOGINFO("fg job (%d) found, forwarding signal to child group...", pid);
+  if (kill(-pid, SIGINT) < 0)
+    printf("Interrupt error: failed to kill %d\n", pid);
+  PROBE2(signal_forward, pid, SIGINT);
+  histadd(H_FORWARD, nowns() - t0);
+}
+
+/*
+ * sigtstp_handler - The kernel sends a SIGTSTP to the shell whenever
+ *     the user types ctrl-z at the keyboard. Catch it and suspend the
+ *     foreground job by sending it a SIGTSTP. As with sigint_handler, a
+ *     fg job holding the tty gets ctrl-z directly instead.
+ */
+void sigtstp_handler(int sig) {
+  unsigned long t0 = nowns();
+  FLOGINFO("handling signal %d", sig);
+  // get current fg job pid
+  pid_t pid = fgpid(jobs);
+  // if no such job, silently return early
+  if (!pid) {
+    printf("no foreground job exists\n");
+    return;
+  }
+  // else stop job by forwarding the signal
+  FLOGINFO("fg job (%d) found, forwarding signal to child group...", pid);
+  if (kill(-pid, SIGTSTP) < 0)
+    printf("Stop error: failed to stop %d\n", pid);
+  PROBE2(signal_forward, pid, SIGTSTP);
+  histadd(H_FORWARD, nowns() - t0);
+}
+
+/*********************
+ * End signal handlers
+ *********************/
+
+/***********************************************
+ * Helper routines that manipulate the job list
+ **********************************************/
+
+/* clearjob - Clear the entries in a job struct */
+void clearjob(struct job_t *job) {
+  if (job->jid) {
+    indexjob(job, 0);
+    PROBE2(job_delete, job->jid, job->pid);
+  }
+  job->pid = 0;
+  job->jid = 0;
+  job->mentry = 0;
+  job->supervised = 0; // else an fg job reusing the slot is restarted
+  job->state = UNDEF;
+  job->cmdline[0] = '\0';
+}
+
+/* initjobs - Initialize the job list */
+void initjobs(struct job_t *jobs) {
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    clearjob(&jobs[i]);
+}
+
+/* maxjid - Returns largest allocated job ID */
+int maxjid(struct job_t *jobs) {
+  int i, max = 0;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].jid > max)
+      max = jobs[i].jid;
+  return max;
+}
+
+/*
+ * addjob - Add a job to the job list, returning it (NULL on failure).
+ *    Queued jobs have no PID yet.
+ */
+struct job_t *addjob(struct job_t *jobs, pid_t pid, int state,
+                     char *cmdline) {
+  int i;
+
+  if (pid < 1 && state != QU) {
+    fprintf(stderr, "Unable to create job for pid %d", pid);
+    return NULL;
+  }
+
+  for (i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].jid == 0) {
+      jobs[i].pid = pid;
+      jobs[i].state = state;
+      jobs[i].jid = nextjid++;
+      if (nextjid > MAXJOBS)
+        nextjid = 1;
+      strcpy(jobs[i].cmdline, cmdline);
+      indexjob(&jobs[i], 1);
+      PROBE3(job_add, jobs[i].jid, pid, jobs[i].cmdline);
+      jobs[i].seq = nextseq++;
+      jobs[i].argslen = -1;
+      jobs[i].key = 0;
+      jobs[i].tagged = 0;
+      jobs[i].ndeps = 0;
+      jobs[i].mentry = 0;
+      jobs[i].supervised = 0;
+      jobs[i].deferred = 0;
+      jobs[i].touched = ++jobclock;
+      clock_gettime(CLOCK_MONOTONIC, &jobs[i].started); // reset on launch
+      jobs[i].tags[0] = '\0';
+      if (verbose) {
+        printf("Added job [%d] %d %s\n", jobs[i].jid, jobs[i].pid,
+               jobs[i].cmdline);
+      }
+      return &jobs[i];
+    }
+  }
+
+  fprintf(stderr, "Tried to create too many jobs\n");
+  return NULL;
+}
+
+/* deletejob - Delete a job whose PID=pid from the job list */
+int deletejob(struct job_t *jobs, pid_t pid) {
+  FLOGINFO("delete requested for job(%d)", pid);
+  int i;
+
+  if (pid < 1)
+    return 0;
+
+  for (i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].pid == pid) {
+      struct job_t job = jobs[i];
+      FLOGINFO("[%d] (%d) %s: job found, deleting", job.jid, job.pid,
+               job.cmdline);
+      clearjob(&jobs[i]);
+      nextjid = maxjid(jobs) + 1;
+      LOGINFO("job deleted");
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* fgpid - Return PID of current foreground job, 0 if no such job */
+pid_t fgpid(struct job_t *jobs) {
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].state == FG)
+      return jobs[i].pid;
+  return 0;
+}
+
+/* getjobpid  - Find a job (by PID) on the job list */
+struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
+  int i;
+
+  if (pid < 1)
+    return NULL;
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid == pid)
+      return &jobs[i];
+  return NULL;
+}
+
+/* getjobjid  - Find a job (by JID) on the job list */
+struct job_t *getjobjid(struct job_t *jobs, int jid) {
+  int i;
+
+  if (jid < 1)
+    return NULL;
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].jid == jid)
+      return &jobs[i];
+  return NULL;
+}
+
+/* pid2jid - Map process ID to job ID */
+int pid2jid(pid_t pid) {
+  int i;
+
+  if (pid < 1)
+    return 0;
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].pid == pid) {
+      return jobs[i].jid;
+    }
+  return 0;
+}
+
+/* listjobs - Print the job list */
+void listjobs(struct job_t *jobs) {
+  int i;
+
+  for (i = 0; i < MAXJOBS; i++)
+    if (jobs[i].jid != 0)
+      printjob(&jobs[i]);
+}
+
+/* printjob - Print one line of the job list */
+void printjob(struct job_t *job) {
+  if (job->pid)
+    printf("[%d] (%d) ", job->jid, job->pid);
+  else // not launched yet
+    printf("[%d] (-) ", job->jid);
+  switch (job->state) {
+  case BG:
+    printf("Running ");
+    break;
+  case FG:
+    printf("Foreground ");
+    break;
+  case ST:
+    printf("Stopped ");
+    break;
+  case QU:
+    printf("Queued ");
+    break;
+  case RS:
+    printf("Restarting ");
+    break;
+  case BL:
+    printf("Blocked (on");
+    for (int j = 0; j < job->ndeps; j++)
+      printf(" %%%d", job->deps[j]);
+    printf(") ");
+    break;
+  default:
+    printf("listjobs: Internal error: job[%d].state=%d ", (int)(job - jobs),
+           job->state);
+  }
+  if (job->supervised)
+    printf("(restarts %d) ", job->restarts);
+  if (job->tags[0])
+    printf("@%s ", job->tags);
+  printf("%s", job->cmdline);
+}
+
+/*
+ * selectjobs - Fill sel w/ the jobs matching any of the nspecs job specs
+ *    (cmd's args), returning how many. A spec is %N, a range %N-%M (or
+ *    %N-M), a PID, %+ (or %%) for the current job, %- for the previous
+ *    one, %?str for jobs w/ str in their command line, %name for jobs
+ *    running a program named name, or @tag for jobs tagged w/ tag; an arg
+ *    may also hold a comma separated list of specs.
+ *    All specs are matched in a single pass over the job list, or if all
+ *    are %?str & %name specs, over just their index candidates. Specs that
+ *    match nothing are reported, & set last_status. Call w/ SIGCHLD
+ *    blocked if the jobs will be changed.
+ */
+int selectjobs(const char *cmd, int nspecs, char **specs, struct job_t **sel) {
+  struct jobspec_t spec[MAXARGS];
+  char buf[MAXLINE], *text = buf, *save;
+  char picked[MAXJOBS] = {0}; // jobs already in sel
+  struct job_t *cur = NULL, *prev = NULL;
+  struct jobset_t visit = {{0}}; // jobs the pass looks at
+  int n = 0, nsel = 0;
+
+  for (int i = 0; i < nspecs; i++) { // parse specs, splitting lists
+    size_t len = strlen(specs[i]);
+    if (text + len >= buf + sizeof(buf))
+      break;
+    strcpy(text, specs[i]);
+    for (char *t = strtok_r(text, ",", &save); t && n < MAXARGS;
+         t = strtok_r(NULL, ",", &save))
+      if (!parsespec(cmd, t, &spec[n++]))
+        return 0;
+    text += len + 1;
+  }
+
+  for (int k = 0; k < n; k++) {
+    if (spec[k].type != JS_SUB && spec[k].type != JS_NAME) { // unindexed
+      memset(&visit, 0xff, sizeof(visit));
+      break;
+    }
+    for (size_t w = 0; w < MAXJOBS / JOBSET_BITS; w++)
+      visit.bits[w] |= spec[k].cand.bits[w];
+  }
+
+  for (size_t w = 0; w < MAXJOBS / JOBSET_BITS; w++)
+    for (unsigned long bits = visit.bits[w]; bits; bits &= bits - 1) {
+      int i = w * JOBSET_BITS + __builtin_ctzl(bits);
+      struct job_t *job = &jobs[i];
+      if (!job->jid)
+        continue;
+      if (!cur || job->touched > cur->touched)
+        prev = cur, cur = job;
+      else if (!prev || job->touched > prev->touched)
+        prev = job;
+      for (int k = 0; k < n; k++)
+        if (matchspec(&spec[k], job)) {
+          spec[k].hits++;
+          if (!picked[i]) {
+            picked[i] = 1;
+            sel[nsel++] = job;
+          }
+        }
+    }
+
+  for (int k = 0; k < n; k++) { // %+ & %- are only known after the pass
+    struct job_t *job = spec[k].type == JS_CUR    ? cur
+                        : spec[k].type == JS_PREV ? prev
+                                                  : NULL;
+    if (job) {
+      spec[k].hits++;
+      if (!picked[job - jobs]) {
+        picked[job - jobs] = 1;
+        sel[nsel++] = job;
+      }
+    }
+    if (spec[k].hits)
+      continue;
+    last_status = 1;
+    if (spec[k].type == JS_JID && spec[k].lo == spec[k].hi)
+      fprintf(stderr, "%%%ld: No such job\n", spec[k].lo);
+    else if (spec[k].type == JS_PID)
+      fprintf(stderr, "(%ld): No such process\n", spec[k].lo);
+    else
+      fprintf(stderr, "%s: No such job\n", spec[k].text);
+  }
+  return nsel;
+}
+
+/*
+ * parsespec - Parse job spec text for cmd into spec (see selectjobs).
+ *    Returns 1 on success, or 0 after alerting the user.
+ */
+int parsespec(const char *cmd, char *text, struct jobspec_t *spec) {
+  char *endptr, *id = text;
+
+  memset(spec, 0, sizeof(*spec));
+  spec->text = text;
+  if (text[0] == '@' && text[1]) {
+    spec->type = JS_TAG;
+    spec->str = text + 1;
+    return 1;
+  }
+  if (text[0] == '%') {
+    id++;
+    if ((id[0] == '+' || id[0] == '%' || id[0] == '-') && !id[1]) {
+      spec->type = id[0] == '-' ? JS_PREV : JS_CUR;
+      return 1;
+    }
+    if (id[0] == '?' && id[1]) { // candidates have all of str's trigrams
+      spec->type = JS_SUB;
+      spec->str = id + 1;
+      memset(&spec->cand, 0xff, sizeof(spec->cand));
+      for (const char *g = spec->str; g[0] && g[1] && g[2]; g++)
+        for (size_t k = 0; k < MAXJOBS / JOBSET_BITS; k++)
+          spec->cand.bits[k] &= jobindex.grams[gramhash(g)].bits[k];
+      return 1;
+    }
+    if (id[0] && !isdigit(id[0])) {
+      spec->type = JS_NAME;
+      spec->str = id;
+      spec->cand = jobindex.names[namehash(id, strlen(id))];
+      return 1;
+    }
+  }
+
+  // id str -> num conversion
+  spec->type = id == text ? JS_PID : JS_JID;
+  spec->lo = spec->hi = strtol(id, &endptr, 10);
+  if (endptr == id)
+    endptr = text; // no number, so an error below
+  else if (endptr != id && *endptr == '-' && spec->type == JS_JID) { // range
+    id = endptr + 1 + (endptr[1] == '%');
+    spec->hi = strtol(id, &endptr, 10);
+    if (endptr == id)
+      endptr = id - 1; // not a number, so an error below
+  }
+  // num converted successfully if endptr is null char
+  if (endptr == text || *endptr != '\0' || spec->lo > spec->hi) {
+    fprintf(stderr, "%s: argument must be a PID or %%jobid\n", cmd);
+    return 0;
+  }
+  return 1;
+}
+
+/* matchspec - Return true if job matches spec (other than %+ & %-) */
+int matchspec(struct jobspec_t *spec, struct job_t *job) {
+  switch (spec->type) {
+  case JS_JID:
+    return job->jid >= spec->lo && job->jid <= spec->hi;
+  case JS_PID:
+    return job->pid && job->pid == spec->lo;
+  case JS_SUB:
+    return JOBSET_HAS(&spec->cand, job - jobs) &&
+           strstr(job->cmdline, spec->str) != NULL;
+  case JS_NAME: {
+    const char *name;
+    if (!JOBSET_HAS(&spec->cand, job - jobs))
+      return 0;
+    size_t len = jobname(job->cmdline, &name);
+    return len == strlen(spec->str) && strncmp(name, spec->str, len) == 0;
+  }
+  case JS_TAG:
+    return hastag(job, spec->str, strlen(spec->str));
+  }
+  return 0;
+}
+
+/*
+ * indexjob - Add job to (or remove it from) the job indexes: by the
+ *    basename of its program, for %name specs, & by each trigram of its
+ *    command line, for %?str specs. Lookups intersect the index sets to
+ *    find candidates, then check each one, so the indexes can be hashed.
+ */
+void indexjob(struct job_t *job, int add) {
+  int i = job - jobs;
+  const char *name;
+  size_t len = jobname(job->cmdline, &name);
+
+  if (add)
+    JOBSET_ADD(&jobindex.names[namehash(name, len)], i);
+  else
+    JOBSET_DEL(&jobindex.names[namehash(name, len)], i);
+  for (const char *g = job->cmdline; g[0] && g[1] && g[2]; g++)
+    if (add)
+      JOBSET_ADD(&jobindex.grams[gramhash(g)], i);
+    else
+      JOBSET_DEL(&jobindex.grams[gramhash(g)], i);
+}
+
+/*
+ * jobname - Point name at the basename of the program in cmdline, past
+ *    any NAME=value assigns, returning its length
+ */
+size_t jobname(const char *cmdline, const char **name) {
+  const char *c = cmdline, *end;
+
+  while (1) {
+    c += strspn(c, " \t");
+    end = c + strcspn(c, " \t\n");
+    if (!isassign(c) || !*end)
+      break;
+    c = end;
+  }
+  for (*name = c; c < end; c++)
+    if (*c == '/')
+      *name = c + 1;
+  return end - *name;
+}
+
+/* namehash - FNV-1a hash of a program name, for the name index */
+unsigned namehash(const char *name, size_t len) {
+  unsigned h = 2166136261u;
+
+  while (len--)
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  return h % NAMEBUCKETS;
+}
+
+/* gramhash - Hash of the 3 chars at gram, for the trigram index */
+unsigned gramhash(const char *gram) {
+  unsigned g = (unsigned char)gram[0] << 16 | (unsigned char)gram[1] << 8 |
+               (unsigned char)gram[2];
+  return (g * 2654435761u) >> 22; // top 10 bits, so < GRAMBUCKETS
+}
+
+/* hastag - Return true if job has the tag of len chars */
+int hastag(struct job_t *job, const char *tag, size_t len) {
+  for (const char *t = job->tags; (t = strstr(t, tag)); t++)
+    if ((t == job->tags || t[-1] == ' ') && (t[len] == ' ' || !t[len]))
+      return 1;
+  return 0;
+}
+
+/* runningjobs - Count jobs using a job slot (in the FG or BG states) */
+int runningjobs(void) {
+  int i, n = 0;
+
+  for (i = 0; i < MAXJOBS; i++)
+    n += jobs[i].state == FG || jobs[i].state == BG;
+  return n;
+}
+
+/* queuedjobs - Count jobs waiting in the QU state for a slot or token */
+int queuedjobs(void) {
+  int i, n = 0;
+
+  for (i = 0; i < MAXJOBS; i++)
+    n += jobs[i].state == QU;
+  return n;
+}
+
+/*
+ * queuejob - Add a queued job for cmdline, saving its NAME=value assigns
+ *    & args so it can be launched later, even from a signal handler.
+ *    Returns the job, or NULL (after alerting the user) on failure. Call
+ *    with SIGCHLD blocked.
+ */
+struct job_t *queuejob(char *cmdline, char **assigns, int nassign,
+                       char **argv, int argc) {
+  char args[MAXLINE]; // packed assigns & args
+  int len = packargs(args, assigns, nassign, argv, argc);
+
+  if (len < 0) {
+    fprintf(stderr, "Argument list too long to queue\n");
+    return NULL;
+  }
+
+  struct job_t *job = addjob(jobs, 0, QU, cmdline);
+  if (!job)
+    return NULL;
+  clock_gettime(CLOCK_MONOTONIC, &job->queued);
+  memcpy(job->args, args, len);
+  job->argslen = len;
+  job->nassign = nassign;
+  job->nargs = nassign + argc;
+  return job;
+}
+
+/*
+ * packargs - Pack n NAME=value assigns then argc args into dest (of size
+ *    MAXLINE), null separated, as saved in a job's args. Returns the size
+ *    used, or -1 if they don't fit.
+ */
+int packargs(char *dest, char **assigns, int nassign, char **argv, int argc) {
+  int len = 0;
+
+  if (nassign + argc > MAXARGS)
+    return -1;
+  for (int i = 0; i < nassign + argc; i++) {
+    char *arg = i < nassign ? assigns[i] : argv[i - nassign];
+    int n = strlen(arg) + 1;
+    if (len + n > MAXLINE)
+      return -1;
+    memcpy(dest + len, arg, n);
+    len += n;
+  }
+  return len;
+}
+
+/*
+ * jobkey - FNV-1a hash of a job's packed args (of size len), the current
+ *    directory & the exported env, identifying identical jobs for dedup.
+ */
+unsigned long jobkey(const char *args, int len) {
+  unsigned long h = 14695981039346656037UL;
+  char cwd[MAXLINE];
+
+  for (int i = 0; i < len; i++)
+    h = (h ^ (unsigned char)args[i]) * 1099511628211UL;
+  if (getcwd(cwd, MAXLINE))
+    for (char *c = cwd; *c; c++)
+      h = (h ^ (unsigned char)*c) * 1099511628211UL;
+  return (h ^ dedup.envgen) * 1099511628211UL;
+}
+
+/*
+ * findtwin - Find a running or queued bg job w/ the given key & packed
+ *    args, or NULL if there's none.
+ */
+struct job_t *findtwin(unsigned long key, const char *args, int len) {
+  for (int i = 0; i < MAXJOBS; i++)
+    if ((jobs[i].state == BG || jobs[i].state == QU) && jobs[i].key == key &&
+        jobs[i].argslen == len && memcmp(jobs[i].args, args, len) == 0)
+      return &jobs[i];
+  return NULL;
+}
+
+/*
+ * donestatus - Exit status of the finished job w/ the given seq, or -1 if
+ *    it's not in donejobs (still running, or finished too long ago).
+ */
+int donestatus(unsigned long seq) {
+  unsigned long oldest = ndonejobs > MAXDONE ? ndonejobs - MAXDONE : 0;
+
+  for (unsigned long i = ndonejobs; i-- > oldest;)
+    if (donejobs[i % MAXDONE].seq == seq)
+      return donejobs[i % MAXDONE].status;
+  return -1;
+}
+
+/*
+ * startjob - Launch queued job in the given state (FG or BG), from its
+ *    saved args. Call with SIGCHLD blocked, or from sigchld_handler only
+ *    while tsh is idle, as it allocates & logs (see setidle). Returns 1 on
+ *    success, 0 if the fork failed (the job stays queued).
+ */
+int startjob(struct job_t *job, int state) {
+  char *args[MAXARGS + 1]; // assigns then argv, pointing into job->args
+  char *a = job->args;
+
+  for (int i = 0; i < job->nargs; i++, a += strlen(a) + 1)
+    args[i] = a;
+  args[job->nargs] = NULL;
+
+  forkat = nowns();
+  pid_t pid = fork();
+  if (pid < 0) {
+    LOGERR("unable to fork queued job");
+    return 0;
+  }
+  if (pid > 0)
+    histadd(H_FORK, nowns() - forkat);
+  if (pid == 0)
+    execjob(args + job->nassign, getenvp(), args, job->nassign, state == FG,
+            job->tagged ? args[job->nargs - 1] : NULL);
+
+  setpgid(pid, pid); // as in the child, so the job can be signalled now
+  PROBE3(job_spawn, pid, job->cmdline, state == FG);
+  if (state == FG) // hand tty to job from parent too
+    giveterm(pid);
+  clock_gettime(CLOCK_MONOTONIC, &job->started);
+  job->pid = pid;
+  job->state = state;
+  FLOGINFO("[%d] (%d) launched queued job", job->jid, pid);
+  return 1;
+}
+
+/*
+ * launchqueued - Launch queued jobs in FIFO order while there are free job
+ *    slots & launch tokens. Call with SIGCHLD blocked, or from
+ *    sigchld_handler while tsh is idle.
+ */
+void launchqueued(void) {
+  while (runningjobs() < jobslots) {
+    struct job_t *next = NULL; // earliest queued job
+
+    for (int i = 0; i < MAXJOBS; i++)
+      if (jobs[i].state == QU && (!next || jobs[i].seq < next->seq))
+        next = &jobs[i];
+    if (!next)
+      return;
+    if (!taketoken()) { // try again once there's a token
+      armtimer(tokenwait());
+      return;
+    }
+    if (!startjob(next, BG))
+      return;
+    if (next->deferred) {
+      ratelimit.launched++;
+      ratelimit.waited += (next->started.tv_sec - next->queued.tv_sec) +
+                          (next->started.tv_nsec - next->queued.tv_nsec) / 1e9;
+      next->deferred = 0;
+    }
+  }
+}
+
+/*
+ * pumpjobs - Queue supervised jobs that are due, launch queued jobs into
+ *    free job slots & then start manifest entries in any left. Call with
+ *    SIGCHLD blocked, or from sigchld_handler while tsh is idle.
+ */
+void pumpjobs(void) {
+  pumpdue = 0;
+  pumprestarts();
+  launchqueued();
+  pumpmanifest();
+}
+
+/*
+ * setidle - Mark tsh as about to block (on) or back from blocking (off).
+ *    Launching a job forks, allocates & logs, which isn't safe from a
+ *    handler that may have interrupted malloc or stdio. So sigchld_handler
+ *    launches jobs itself only while tsh is idle, blocked in a read or
+ *    sigsuspend, & otherwise leaves them to pumpjobs here.
+ */
+void setidle(int on) {
+  sigset_t mask_sigchld, prev_sigset;
+
+  if (!on) {
+    idle = 0;
+    return;
+  }
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  if (pumpdue)
+    pumpjobs();
+  idle = 1;
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/* idlewait - sigsuspend w/ mask while idle, see setidle */
+void idlewait(const sigset_t *mask) {
+  setidle(1);
+  sigsuspend(mask);
+  setidle(0);
+}
+
+/*
+ * taketoken - Take a token to launch a bg job, if the launch rate limit
+ *    allows one now. Returns 1 if so, 0 if the launch must wait.
+ */
+int taketoken(void) {
+  struct timespec now;
+
+  if (ratelimit.rate <= 0)
+    return 1;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  ratelimit.tokens += ratelimit.rate * ((now.tv_sec - ratelimit.last.tv_sec) +
+                                        (now.tv_nsec - ratelimit.last.tv_nsec) /
+                                            1e9);
+  if (ratelimit.tokens > ratelimit.burst)
+    ratelimit.tokens = ratelimit.burst;
+  ratelimit.last = now;
+  if (ratelimit.tokens < 1)
+    return 0;
+  ratelimit.tokens -= 1;
+  return 1;
+}
+
+/* tokenwait - Secs until the next launch token, as of the last taketoken */
+double tokenwait(void) {
+  return ratelimit.rate > 0 ? (1 - ratelimit.tokens) / ratelimit.rate : 0;
+}
+
+/*
+ * execjob - In a newly forked child, set up & exec the job's program with
+ *    the given env plus NAME=value assigns. If tag isn't NULL, the job's
+ *    output lines are prefixed with it. Never returns.
+ */
+void execjob(char **argv, char **env, char **assigns, int nassign, int fg,
+             const char *tag) {
+  sigset_t mask_sigchld;
+
+  setpgrp(); // ensure all children are in own process group
+  if (interactive) {
+    // take the tty while SIGTTOU is still ignored, as the parent may not
+    // have handed it over yet & we're in a background group until then
+    if (fg)
+      tcsetpgrp(STDIN_FILENO, getpid()); // take tty before exec
+    signal(SIGTTOU, SIG_DFL); // undo tsh's ignore before exec
+  }
+  signal(SIGCHLD, SIG_DFL); // tsh's handler works on tsh's job list only
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  if (sigprocmask(SIG_UNBLOCK, &mask_sigchld, NULL) !=
+      0) // allow child to handle sigchld
+    fprintf(stderr, "WARNING: failed to unblock SIGCHLD");
+  if (tag)
+    tagoutput(tag);
+
+  FLOGINFO("%s: executing command in child process...", argv[0]);
+  env = overlayenv(env, assigns, nassign); // child's copy, no need to undo
+  histadd(H_EXEC, nowns() - forkat); // shared w/ tsh, see initstats
+  int result = execve(argv[0], argv, env); // exec command program
+  if (result < 0) { // execve returns negative if command isn't found
+    // write & _exit, as stdout's buffer may still hold tsh's own output
+    char msg[MAXLINE];
+    int len = snprintf(msg, MAXLINE, "%s: Command not found\n", argv[0]);
+    write(STDOUT_FILENO, msg, len < MAXLINE ? len : MAXLINE - 1);
+    _exit(1);
+  }
+
+  LOGINFO("...done. exiting child process");
+  exit(0); // "return early" by exiting child process w/ success state
+}
+
+/*
+ * tagoutput - Called in a job's child after it joins its process group.
+ *    Forks again: the new child returns, w/ its stdout on a pipe, to exec
+ *    the program, while this process copies each line from the pipe to
+ *    the real stdout prefixed w/ "tag\t", then exits w/ the program's
+ *    status. Both stay in the job's process group, so signals reach both.
+ */
+void tagoutput(const char *tag) {
+  int fds[2];
+  char buf[MAXLINE];
+  size_t len = 0, taglen = strlen(tag);
+  ssize_t n;
+  int status;
+
+  if (pipe(fds) < 0)
+    unix_error("tagoutput error");
+  pid_t pid = fork();
+  if (pid < 0)
+    unix_error("tagoutput error");
+  if (pid == 0) { // program side
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[0]);
+    close(fds[1]);
+    return;
+  }
+
+  close(fds[1]);
+  while ((n = read(fds[0], buf + len, sizeof(buf) - len)) > 0) {
+    char *start = buf, *end = buf + len + n, *nl;
+
+    // write out each complete line, or the whole buffer if it's one long line
+    while ((nl = memchr(start, '\n', end - start)) ||
+           (start == buf && end == buf + sizeof(buf) && (nl = end - 1))) {
+      write(STDOUT_FILENO, tag, taglen);
+      write(STDOUT_FILENO, "\t", 1);
+      write(STDOUT_FILENO, start, nl + 1 - start);
+      start = nl + 1;
+    }
+    len = end - start;
+    memmove(buf, start, len);
+  }
+  if (len) { // last line w/o a newline
+    write(STDOUT_FILENO, tag, taglen);
+    write(STDOUT_FILENO, "\t", 1);
+    write(STDOUT_FILENO, buf, len);
+    write(STDOUT_FILENO, "\n", 1);
+  }
+
+  while (waitpid(pid, &status, 0) < 0 && errno == EINTR)
+    ;
+  _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+}
+
+/*
+ * jobexited - Called from sigchld_handler when job exits or is killed,
+ *    before it's deleted, with its wait status & resource usage (NULL if
+ *    it never ran). Frees the job's slot if a parallel builtin started it,
+ *    records the result if it's a manifest entry, & unblocks jobs waiting
+ *    on it, or cancels them if they need it to succeed & it didn't.
+ *    Unblocked jobs are queued, for sigchld_handler to launch. Supervised
+ *    jobs are kept to be restarted instead, see restartjob.
+ */
+void jobexited(struct job_t *job, int wstatus, struct rusage *ru) {
+  int status = exitcode(wstatus);
+
+  if (job->supervised && job->pid && restartjob(job, wstatus))
+    return; // job lives on
+
+  struct done_t *done = &donejobs[ndonejobs++ % MAXDONE]; // for wait
+  done->seq = job->seq;
+  done->status = status;
+  done->wstatus = wstatus;
+  strcpy(done->cmdline, job->cmdline);
+  clock_gettime(CLOCK_REALTIME, &done->ended);
+  done->jid = job->jid;
+  done->pid = job->pid;
+  done->wall = 0;
+  if (job->pid) { // for jobs -l
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    done->wall = (now.tv_sec - job->started.tv_sec) +
+                 (now.tv_nsec - job->started.tv_nsec) / 1e9;
+  }
+  if (ru)
+    done->ru = *ru;
+  else
+    memset(&done->ru, 0, sizeof(done->ru));
+
+  if (job->mentry)
+    finishentry(&manifest.entries[job->mentry - 1], wstatus, ru);
+  for (int i = 0; parallel && job->pid && i < parallel->nslots; i++)
+    if (parallel->pids[i] == job->pid) {
+      parallel->status[parallel->inputs[i]] = status;
+      parallel->pids[i] = 0;
+      parallel->running--;
+      break;
+    }
+
+  for (int i = 0; i < MAXJOBS; i++) {
+    struct job_t *dep = &jobs[i];
+    int n = 0;
+
+    if (dep->state != BL)
+      continue;
+    for (int j = 0; j < dep->ndeps; j++) // drop job from dep's list
+      if (dep->deps[j] != job->jid)
+        dep->deps[n++] = dep->deps[j];
+    if (n == dep->ndeps)
+      continue;
+    dep->ndeps = n;
+
+    if (status && dep->needok) { // cancel, & its own dependents in turn
+      printf("Job [%d] cancelled, job [%d] failed with status %d\n",
+             dep->jid, job->jid, status);
+      jobexited(dep, wstatus, NULL);
+      clearjob(dep);
+      nextjid = maxjid(jobs) + 1;
+    } else if (n == 0) {
+      dep->state = QU;
+    }
+  }
+}
+
+/*
+ * restartjob - Called when supervised job exits, w/ its wait status. Moves
+ *    job to the RS state to be restarted, keeping its JID, right away if it
+ *    ran for CRASHSECS or more, or else after a backoff that doubles w/
+ *    each crash in a row. Returns 1 if job will be restarted, or 0 if it
+ *    was stopped by ctrl-c or has crashed too many times in a row.
+ */
+int restartjob(struct job_t *job, int wstatus) {
+  struct timespec now;
+
+  if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGINT)
+    return 0; // user stopped it
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  if (now.tv_sec - job->started.tv_sec < CRASHSECS) {
+    if (++job->crashes > job->maxcrashes) {
+      printf("Job [%d] (%d) crashed %d times in a row, not restarting\n",
+             job->jid, job->pid, job->crashes);
+      return 0;
+    }
+  } else {
+    job->crashes = 0;
+  }
+
+  long backoff = job->crashes ? 1L << (job->crashes < 7 ? job->crashes - 1 : 6)
+                              : 0;
+  if (backoff > MAXBACKOFF)
+    backoff = MAXBACKOFF;
+  printf("Job [%d] (%d) exited with status %d, restarting in %lds\n",
+         job->jid, job->pid, exitcode(wstatus), backoff);
+  job->due = now;
+  job->due.tv_sec += backoff;
+  job->pid = 0;
+  job->state = RS;
+  job->restarts++;
+  return 1;
+}
+
+/*
+ * pumprestarts - Queue supervised jobs whose restart backoff has elapsed,
+ *    & arm the timer for the next one. Call with SIGCHLD blocked, or from
+ *    sigchld_handler.
+ */
+void pumprestarts(void) {
+  struct timespec now;
+  double wait = -1; // secs until the next restart is due, if any
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for (int i = 0; i < MAXJOBS; i++) {
+    if (jobs[i].state != RS)
+      continue;
+    double d = (jobs[i].due.tv_sec - now.tv_sec) +
+               (jobs[i].due.tv_nsec - now.tv_nsec) / 1e9;
+    if (d <= 0)
+      jobs[i].state = QU; // keeps its seq, so it's launched first
+    else if (wait < 0 || d < wait)
+      wait = d;
+  }
+  if (wait > 0)
+    armtimer(wait);
+}
+
+/*
+ * armtimer - Have SIGALRM go off in secs, unless it's already due sooner.
+ *    The retry timer is shared by the manifest runner & supervised jobs.
+ */
+void armtimer(double secs) {
+  struct itimerval timer;
+
+  getitimer(ITIMER_REAL, &timer);
+  double left = timer.it_value.tv_sec + timer.it_value.tv_usec / 1e6;
+  if (left > 0 && left <= secs)
+    return;
+  if (secs < 0.001)
+    secs = 0.001;
+  timer.it_interval.tv_sec = timer.it_interval.tv_usec = 0;
+  timer.it_value.tv_sec = secs;
+  timer.it_value.tv_usec = (secs - (long)secs) * 1e6;
+  setitimer(ITIMER_REAL, &timer, NULL);
+}
+
+/* exitcode - Exit status of a job from its wait status, as in $? */
+int exitcode(int wstatus) {
+  if (WIFEXITED(wstatus))
+    return WEXITSTATUS(wstatus);
+  return 128 + (WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : WSTOPSIG(wstatus));
+}
+/******************************
+ * end job list helper routines
+ ******************************/
+
+/*****************************************
+ * Helper routines for the shell variables
+ *****************************************/
+
+/*
+ * initvars - Load the inherited environment into the variable table. Runs
+ *    lazily on first use of a variable, so commands that never touch one
+ *    (e.g. under -c) exec with the inherited environ as is.
+ */
+void initvars(void) {
+  size_t n = 0;
+  while (environ[n])
+    n++;
+  varcap = MINVARS;
+  while (varcap * 7 < n * 10) // keep load factor under 70%
+    varcap <<= 1;
+
+  sigset_t mask_sigchld, prev_sigset; // queued jobs launch w/ getenvp
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  vars = calloc(varcap, sizeof(struct var_t));
+  if (!vars)
+    unix_error("initvars error");
+
+  // insert directly, as varcap already fits them all, & build envp once
+  for (size_t i = 0; i < n; i++) {
+    if (!isassign(environ[i])) // skip names setvar would reject
+      continue;
+    size_t nlen = strchr(environ[i], '=') - environ[i];
+    struct var_t *v = findslot(environ[i], nlen);
+    if (v->kv) // first one wins, as w/ getenv
+      continue;
+    if (!(v->kv = strdup(environ[i])))
+      unix_error("initvars error");
+    v->nlen = nlen;
+    v->exported = 1;
+    varcnt++;
+  }
+  envdirty = 1;
+  getenvp();
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * varhash - FNV-1a hash of a var name of length nlen
+ */
+size_t varhash(const char *name, size_t nlen) {
+  size_t h = 14695981039346656037UL;
+
+  for (size_t i = 0; i < nlen; i++)
+    h = (h ^ (unsigned char)name[i]) * 1099511628211UL;
+  return h;
+}
+
+/*
+ * findslot - Find the slot holding var name (of length nlen), or else
+ *    the empty slot where it would be inserted, by linear probing. Deleted
+ *    slots (kv == NULL but nlen != 0) are skipped over but reused.
+ */
+struct var_t *findslot(const char *name, size_t nlen) {
+  size_t mask = varcap - 1;
+  struct var_t *reuse = NULL; // first deleted slot passed, if any
+
+  for (size_t i = varhash(name, nlen) & mask;; i = (i + 1) & mask) {
+    struct var_t *v = &vars[i];
+    if (!v->kv && !v->nlen) // never used, so name isn't further on
+      return reuse ? reuse : v;
+    if (!v->kv) {
+      if (!reuse)
+        reuse = v;
+    } else if (v->nlen == nlen && memcmp(v->kv, name, nlen) == 0) {
+      return v;
+    }
+  }
+}
+
+/* findvar - Find the var called name (of length nlen), NULL if unset */
+struct var_t *findvar(const char *name, size_t nlen) {
+  if (!vars)
+    initvars();
+
+  struct var_t *v = findslot(name, nlen);
+  return v->kv ? v : NULL;
+}
+
+/* getvar - Get the value of var name (of length nlen), NULL if unset */
+char *getvar(const char *name, size_t nlen) {
+  struct var_t *v = findvar(name, nlen);
+  return v ? v->kv + nlen + 1 : NULL;
+}
+
+/*
+ * setvar - Set var name (of length nlen) to value, creating it if needed.
+ *    A var stays exported once it is; otherwise exported says whether to
+ *    export it. Returns 0 on success, -1 if name isn't a valid identifier.
+ *    SIGCHLD is blocked & envp rebuilt before returning, so sigchld_handler
+ *    can launch queued jobs with getenvp without allocating.
+ */
+int setvar(const char *name, size_t nlen, const char *value, int exported) {
+  if (nlen == 0 || isdigit(*name))
+    return -1;
+  for (size_t i = 0; i < nlen; i++)
+    if (!isalnum(name[i]) && name[i] != '_')
+      return -1;
+
+  if (!vars)
+    initvars();
+
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+
+  struct var_t *v = findslot(name, nlen);
+  if (!v->kv && !v->nlen && ++varcnt * 10 > varcap * 7) { // grow & rehash
+    struct var_t *old = vars;
+    size_t oldcap = varcap;
+
+    varcap <<= 1;
+    vars = calloc(varcap, sizeof(struct var_t));
+    if (!vars)
+      unix_error("setvar error");
+    varcnt = 1; // counting the new var
+    for (size_t i = 0; i < oldcap; i++)
+      if (old[i].kv) {
+        *findslot(old[i].kv, old[i].nlen) = old[i];
+        varcnt++;
+      }
+    free(old);
+    v = findslot(name, nlen);
+  }
+
+  char *kv = malloc(nlen + strlen(value) + 2);
+  if (!kv)
+    unix_error("setvar error");
+  memcpy(kv, name, nlen);
+  kv[nlen] = '=';
+  strcpy(kv + nlen + 1, value);
+
+  if (v->kv) {
+    exported |= v->exported;
+    free(v->kv);
+  } else {
+    v->nlen = nlen;
+  }
+  v->kv = kv;
+  v->exported = exported;
+  if (exported) {
+    envdirty = 1;
+    getenvp();
+  }
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+  return 0;
+}
+
+/* unsetvar - Remove var name, leaving a deleted marker in its slot */
+void unsetvar(const char *name) {
+  struct var_t *v = findvar(name, strlen(name));
+
+  if (!v)
+    return;
+
+  sigset_t mask_sigchld, prev_sigset; // as in setvar
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  free(v->kv);
+  v->kv = NULL; // nlen stays set, marking the slot as deleted
+  if (v->exported) {
+    v->exported = 0;
+    envdirty = 1;
+    getenvp();
+  }
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * getenvp - Get the environment for exec'd jobs. The array is cached &
+ *    rebuilt by setvar & unsetvar when an exported var changes.
+ */
+char **getenvp(void) {
+  if (!vars) // nothing changed yet, so the inherited env is still right
+    return environ;
+  if (!envdirty)
+    return envp;
+
+  size_t n = 0;
+  for (size_t i = 0; i < varcap; i++)
+    n += vars[i].kv && vars[i].exported;
+
+  free(envp);
+  envp = malloc((n + 1 + MAXARGS) * sizeof(char *)); // room for overlayenv
+  if (!envp)
+    unix_error("getenvp error");
+
+  n = 0;
+  for (size_t i = 0; i < varcap; i++)
+    if (vars[i].kv && vars[i].exported) {
+      vars[i].envi = n;
+      envp[n++] = vars[i].kv;
+    }
+  envp[n] = NULL;
+  envlen = n;
+
+  envdirty = 0;
+  dedup.envgen++;
+  FLOGINFO("rebuilt envp with %zu vars", n);
+  return envp;
+}
+
+/*
+ * overlayenv - Return env w/ n NAME=value assigns applied on top, each
+ *    replacing the entry for its NAME or else appended. Meant for a forked
+ *    child about to exec, whose envp is its own copy: that's patched in
+ *    place, finding entries through the var table & appending into the free
+ *    slots getenvp leaves. Any other env (i.e. environ) is copied first.
+ */
+char **overlayenv(char **env, char **assigns, int n) {
+  size_t len = 0;
+
+  if (n == 0)
+    return env;
+  if (env == envp && !envdirty) {
+    len = envlen;
+    for (int i = 0; i < n; i++) {
+      size_t nlen = strchr(assigns[i], '=') - assigns[i];
+      struct var_t *v = findvar(assigns[i], nlen);
+      size_t j = envlen; // else look among earlier appends, e.g. X=1 X=2
+      if (v && v->exported)
+        j = v->envi;
+      else
+        while (j < len && strncmp(env[j], assigns[i], nlen + 1) != 0)
+          j++;
+      env[j] = assigns[i];
+      len += j == len;
+    }
+    env[len] = NULL;
+    return env;
+  }
+
+  while (env[len])
+    len++;
+  char **res = malloc((len + n + 1) * sizeof(char *));
+  if (!res)
+    unix_error("overlayenv error");
+  memcpy(res, env, len * sizeof(char *));
+  for (int i = 0; i < n; i++) {
+    size_t nlen = strchr(assigns[i], '=') - assigns[i] + 1; // w/ the '='
+    size_t j = 0;
+    while (j < len && strncmp(res[j], assigns[i], nlen) != 0)
+      j++;
+    res[j] = assigns[i];
+    len += j == len;
+  }
+  res[len] = NULL;
+  return res;
+}
+
+/* isassign - Return true if word is a NAME=value assignment */
+int isassign(const char *word) {
+  const char *c = word;
+
+  if (!isalpha(*c) && *c != '_')
+    return 0;
+  while (isalnum(*c) || *c == '_')
+    c++;
+  return *c == '=';
+}
+
+/**********************************
+ * Helper routines for glob patterns
+ **********************************/
+
+/*
+ * globargs - Replace each unquoted arg in argv containing *, ? or [ with
+ *    the sorted names of files it matches, leaving it as is if none do.
+ *    Names are copied into pool (of given size). Only the last path
+ *    component may be a pattern. Returns 0 on success, -1 if the expanded
+ *    args don't fit (after alerting the user).
+ */
+int globargs(int *argc, char **argv, const int *quoted, char *pool,
+             size_t size) {
+  char *out[MAXARGS]; // expanded args
+  int n = 0;
+
+  for (int i = 0; i < *argc; i++) {
+    int m = 0; // number of matches
+
+    if (!quoted[i] && strpbrk(argv[i], "*?[")) {
+      m = globword(argv[i], out + n, MAXARGS - 1 - n, &pool, &size);
+      if (m < 0) {
+        fprintf(stderr, "Argument list too long\n");
+        return -1;
+      }
+    }
+    if (m == 0) // not a pattern, or no matches
+      out[n++] = argv[i];
+    n += m;
+  }
+
+  memcpy(argv, out, n * sizeof(char *));
+  argv[n] = NULL;
+  *argc = n;
+  return 0;
+}
+
+/* cmpstr - qsort comparator for an array of strings */
+int cmpstr(const void *a, const void *b) {
+  return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/*
+ * globword - Save up to max names of files matching pattern in dest, in
+ *    sorted order, copying them into *pool & advancing it. Returns the
+ *    number of matches, or -1 if they don't fit.
+ */
+int globword(char *pattern, char **dest, int max, char **pool, size_t *size) {
+  char dir[MAXLINE];  // directory to search
+  char *base;         // pattern for names in dir
+  size_t prefix = 0;  // length of dir part to prepend to names
+  char *slash = strrchr(pattern, '/');
+
+  if (slash) {
+    prefix = slash - pattern + 1;
+    if (prefix >= sizeof(dir))
+      return 0; // too long to be a directory we could open anyway
+    if (memchr(pattern, '*', prefix) || memchr(pattern, '?', prefix) ||
+        memchr(pattern, '[', prefix))
+      return 0; // patterns in directory names aren't supported
+    memcpy(dir, pattern, prefix);
+    dir[prefix] = '\0';
+    base = slash + 1;
+  } else {
+    strcpy(dir, ".");
+    base = pattern;
+  }
+
+  struct dircache_t *d = readdircached(dir);
+  if (!d)
+    return 0;
+
+  int m = 0;
+  char *name = d->names;
+  for (int i = 0; i < d->count; i++, name += strlen(name) + 1) {
+    if (fnmatch(base, name, FNM_PERIOD) != 0)
+      continue;
+    if (m == max)
+      return -1;
+    dest[m++] = name; // points into the cache until copied below
+  }
+  qsort(dest, m, sizeof(char *), cmpstr);
+
+  for (int i = 0; i < m; i++) {
+    size_t len = prefix + strlen(dest[i]) + 1;
+    if (len > *size)
+      return -1;
+    memcpy(*pool, pattern, prefix);
+    strcpy(*pool + prefix, dest[i]);
+    dest[i] = *pool;
+    *pool += len;
+    *size -= len;
+  }
+  return m;
+}
+
+/* linux_dirent64 - Entry returned by the getdents64 syscall */
+struct linux_dirent64 {
+  ino64_t d_ino;
+  off64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+
+/*
+ * readdircached - Get the listing of directory path, reading it with
+ *    large getdents64 batches unless a cached listing is still valid (the
+ *    directory's mtime hasn't changed). Returns NULL if path can't be read.
+ */
+struct dircache_t *readdircached(const char *path) {
+  static char dents[DENTBUF]; // getdents64 batch
+  struct stat st;
+  struct dircache_t *d = NULL;
+
+  if (stat(path, &st) < 0 || !S_ISDIR(st.st_mode))
+    return NULL;
+
+  // use the cached listing if still valid, else evict the LRU one
+  dirclock++;
+  for (int i = 0; i < MAXDIRCACHE; i++) {
+    struct dircache_t *c = &dircache[i];
+    if (strcmp(c->path, path) == 0) {
+      if (c->dev == st.st_dev && c->ino == st.st_ino &&
+          c->mtime.tv_sec == st.st_mtim.tv_sec &&
+          c->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+        FLOGINFO("glob: using cached listing of %s", path);
+        c->lastused = dirclock;
+        return c;
+      }
+      d = c; // stale, reread into same slot
+      break;
+    }
+    if (!d || c->lastused < d->lastused)
+      d = c;
+  }
+
+  int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return NULL;
+
+  size_t cap = DENTBUF; // size of names
+  size_t len = 0;       // used bytes of names
+  char *names = malloc(cap);
+  int count = 0;
+  long nread;
+
+  while (names && (nread = syscall(SYS_getdents64, fd, dents, DENTBUF)) > 0) {
+    for (long off = 0; off < nread;) {
+      struct linux_dirent64 *e = (struct linux_dirent64 *)(dents + off);
+      off += e->d_reclen;
+      if (strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0)
+        continue;
+
+      size_t n = strlen(e->d_name) + 1;
+      if (len + n > cap) {
+        char *grown = realloc(names, cap *= 2);
+        if (!grown) {
+          free(names);
+          names = NULL;
+          break;
+        }
+        names = grown;
+      }
+      memcpy(names + len, e->d_name, n);
+      len += n;
+      count++;
+    }
+  }
+  close(fd);
+  if (!names || nread < 0) {
+    free(names);
+    return NULL;
+  }
+
+  FLOGINFO("glob: read %d entries of %s", count, path);
+  free(d->names);
+  strcpy(d->path, path);
+  d->dev = st.st_dev;
+  d->ino = st.st_ino;
+  d->mtime = st.st_mtim;
+  d->names = names;
+  d->count = count;
+  d->lastused = dirclock;
+  return d;
+}
+
+/*************************************
+ * Helper routines for the manifest runner
+ *************************************/
+
+/*
+ * loadmanifest - Read the manifest at path, one command per line (blank
+ *    lines & lines starting w/ '#' are skipped), & start running it. Each
+ *    line is expanded & split into args once, up front. Entries then run
+ *    as bg jobs in the job slots left over by other jobs, see pumpmanifest.
+ *    Results are written to report, or path + ".jsonl" if NULL, as a JSON
+ *    object per line in the order entries finish.
+ */
+void loadmanifest(const char *path, const char *report) {
+  FILE *f = fopen(path, "r");
+  char line[MAXLINE], expanded[MAXLINE];
+  char *argv[MAXARGS];
+  char argbuf[MAXARGBUF];
+  int argc, cap = 0, lineno = 0;
+
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    exit(1);
+  }
+
+  while (fgets(line, MAXLINE - 1, f)) {
+    lineno++;
+    char *c = line + strspn(line, " \t");
+    if (*c == '\n' || *c == '\0' || *c == '#')
+      continue;
+    if (!strchr(line, '\n'))
+      strcat(line, "\n");
+    if (expand(line, expanded) < 0 ||
+        parseline(expanded, &argc, argv, argbuf, sizeof(argbuf)) < 0) {
+      fprintf(stderr, "%s:%d: skipping bad entry\n", path, lineno);
+      continue;
+    }
+    if (argc == 0)
+      continue;
 
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].state == FG)
-      return jobs[i].pid;
-  return 0;
-}
+    if (manifest.count == cap) {
+      cap = cap ? cap * 2 : 64;
+      manifest.entries =
+          realloc(manifest.entries, cap * sizeof(struct mentry_t));
+      if (!manifest.entries)
+        unix_error("loadmanifest error");
+    }
+    struct mentry_t *e = &manifest.entries[manifest.count];
+    memset(e, 0, sizeof(*e));
+    e->line = lineno;
+    e->nargs = argc;
+    while (e->nassign < argc - 1 && isassign(argv[e->nassign]))
+      e->nassign++;
+    for (int i = 0; i < argc; i++) // globbed args aren't contiguous
+      e->argslen += strlen(argv[i]) + 1;
+    if (e->argslen > MAXLINE) { // won't fit in a job's args
+      fprintf(stderr, "%s:%d: argument list too long\n", path, lineno);
+      continue;
+    }
+    e->args = malloc(e->argslen);
+    e->cmdline = strdup(expanded);
+    if (!e->args || !e->cmdline)
+      unix_error("loadmanifest error");
+    for (int i = 0, len = 0; i < argc; i++) {
+      strcpy(e->args + len, argv[i]);
+      len += strlen(argv[i]) + 1;
+    }
+    manifest.count++;
+  }
+  fclose(f);
 
-/* getjobpid  - Find a job (by PID) on the job list */
-struct job_t *getjobpid(struct job_t *jobs, pid_t pid) {
-  int i;
+  if (!report) {
+    snprintf(line, MAXLINE, "%s.jsonl", path);
+    report = line;
+  }
+  manifest.fd = open(report, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (manifest.fd < 0) {
+    fprintf(stderr, "%s: %s\n", report, strerror(errno));
+    exit(1);
+  }
+  FLOGINFO("loaded %d manifest entries from %s", manifest.count, path);
 
-  if (pid < 1)
-    return NULL;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid)
-      return &jobs[i];
-  return NULL;
+  sigset_t mask_sigchld, prev_sigset;
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  pumpmanifest();
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
 }
 
-/* getjobjid  - Find a job (by JID) on the job list */
-struct job_t *getjobjid(struct job_t *jobs, int jid) {
-  int i;
+/*
+ * pumpmanifest - Launch manifest entries while there are free job slots
+ *    & launch tokens, retries that are due first, then new entries in order. Arms the
+ *    retry timer for the next retry not yet due. Call with SIGCHLD
+ *    blocked, or from sigchld_handler.
+ */
+void pumpmanifest(void) {
+  struct timespec now;
 
-  if (jid < 1)
-    return NULL;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].jid == jid)
-      return &jobs[i];
-  return NULL;
+  if (manifest.ndone == manifest.count)
+    return;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  while (runningjobs() < jobslots) {
+    struct mentry_t *e = NULL;
+
+    for (int i = 0; manifest.nretry && i < manifest.count && !e; i++)
+      if (manifest.entries[i].state == M_RETRY &&
+          (manifest.entries[i].due.tv_sec < now.tv_sec ||
+           (manifest.entries[i].due.tv_sec == now.tv_sec &&
+            manifest.entries[i].due.tv_nsec <= now.tv_nsec)))
+        e = &manifest.entries[i];
+    if (!e && manifest.next < manifest.count)
+      e = &manifest.entries[manifest.next];
+    if (!e)
+      break;
+    if (!taketoken()) {
+      armtimer(tokenwait());
+      break;
+    }
+    if (!launchentry(e, &now))
+      break;
+  }
+
+  if (!manifest.nretry)
+    return;
+  double wait = MAXBACKOFF; // secs until the next retry is due
+  for (int i = 0; i < manifest.count; i++)
+    if (manifest.entries[i].state == M_RETRY) {
+      double d = (manifest.entries[i].due.tv_sec - now.tv_sec) +
+                 (manifest.entries[i].due.tv_nsec - now.tv_nsec) / 1e9;
+      if (d < wait)
+        wait = d;
+    }
+  armtimer(wait); // if due but no job slot is free, try again soon
 }
 
-/* pid2jid - Map process ID to job ID */
-int pid2jid(pid_t pid) {
-  int i;
+/*
+ * launchentry - Launch manifest entry e as a bg job. Returns 1 on success,
+ *    or 0 if there's no room in the job list or the fork failed, leaving
+ *    e to be launched later. Call with SIGCHLD blocked.
+ */
+int launchentry(struct mentry_t *e, struct timespec *now) {
+  struct job_t *job = addjob(jobs, 0, QU, e->cmdline);
 
-  if (pid < 1)
+  if (!job)
     return 0;
-  for (i = 0; i < MAXJOBS; i++)
-    if (jobs[i].pid == pid) {
-      return jobs[i].jid;
+  memcpy(job->args, e->args, e->argslen);
+  job->argslen = e->argslen;
+  job->nargs = e->nargs;
+  job->nassign = e->nassign;
+  if (!startjob(job, BG)) {
+    clearjob(job);
+    nextjid = maxjid(jobs) + 1;
+    return 0;
+  }
+
+  job->mentry = e - manifest.entries + 1;
+  if (e->state == M_RETRY)
+    manifest.nretry--;
+  else
+    manifest.next++;
+  e->state = M_RUN;
+  e->attempts++;
+  e->start = *now;
+  return 1;
+}
+
+/*
+ * finishentry - Record the result of manifest entry e's job, w/ the given
+ *    wait status & resource usage. A failed entry w/ retries left is
+ *    retried after a backoff that doubles w/ each attempt, up to
+ *    MAXBACKOFF secs. Otherwise its result is written to the report.
+ *    Called from sigchld_handler, so the report is written w/ write.
+ */
+void finishentry(struct mentry_t *e, int wstatus, struct rusage *ru) {
+  struct timespec now;
+  char buf[2 * MAXLINE];
+  char cmd[MAXLINE];
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  e->wall = (now.tv_sec - e->start.tv_sec) +
+            (now.tv_nsec - e->start.tv_nsec) / 1e9;
+  e->wstatus = wstatus;
+  if (ru)
+    e->ru = *ru;
+
+  if (exitcode(wstatus) && e->attempts <= manifest.retries) {
+    long backoff = 1L << (e->attempts - 1 < 6 ? e->attempts - 1 : 6);
+    e->due = now;
+    e->due.tv_sec += backoff < MAXBACKOFF ? backoff : MAXBACKOFF;
+    e->state = M_RETRY;
+    manifest.nretry++;
+    return;
+  }
+
+  e->state = M_DONE;
+  manifest.ndone++;
+  manifest.nfailed += exitcode(wstatus) != 0;
+
+  e->cmdline[strcspn(e->cmdline, "\n")] = '\0';
+  jsonstr(cmd, sizeof(cmd), e->cmdline);
+  int len = snprintf(
+      buf, sizeof(buf),
+      "{\"line\":%d,\"cmd\":%s,\"status\":%d,\"signal\":%d,"
+      "\"attempts\":%d,\"wall\":%.6f,\"user\":%.6f,\"sys\":%.6f}\n",
+      e->line, cmd, WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : -1,
+      WIFSIGNALED(wstatus) ? WTERMSIG(wstatus) : 0, e->attempts, e->wall,
+      e->ru.ru_utime.tv_sec + e->ru.ru_utime.tv_usec / 1e6,
+      e->ru.ru_stime.tv_sec + e->ru.ru_stime.tv_usec / 1e6);
+  write(manifest.fd, buf, len < (int)sizeof(buf) ? len : sizeof(buf) - 1);
+
+  if (manifest.ndone == manifest.count)
+    printf("manifest: %d entries, %d failed\n", manifest.count,
+           manifest.nfailed);
+}
+
+/*
+ * waitmanifest - Block until every manifest entry is done, if there's a
+ *    manifest being run.
+ */
+void waitmanifest(void) {
+  sigset_t mask_sigchld, prev_sigset;
+
+  sigemptyset(&mask_sigchld);
+  sigaddset(&mask_sigchld, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask_sigchld, &prev_sigset);
+  while (manifest.ndone < manifest.count)
+    idlewait(&prev_sigset);
+  sigprocmask(SIG_SETMASK, &prev_sigset, NULL);
+}
+
+/*
+ * jsonstr - Write s into dest (of size bytes) as a quoted JSON string,
+ *    truncating it if it doesn't fit. Returns the length written.
+ */
+size_t jsonstr(char *dest, size_t size, const char *s) {
+  size_t len = 0;
+
+  dest[len++] = '"';
+  for (; *s && len < size - 8; s++) { // room for an escape & closing quote
+    unsigned char c = *s;
+    if (c == '"' || c == '\\') {
+      dest[len++] = '\\';
+      dest[len++] = c;
+    } else if (c < 0x20) {
+      len += snprintf(dest + len, size - len, "\\u%04x", c);
+    } else {
+      dest[len++] = c;
     }
-  return 0;
+  }
+  dest[len++] = '"';
+  dest[len] = '\0';
+  return len;
 }
 
-/* listjobs - Print the job list */
-void listjobs(struct job_t *jobs) {
-  int i;
+/*****************************************
+ * Helper routines for the result cache
+ *****************************************/
 
-  for (i = 0; i < MAXJOBS; i++) {
-    if (jobs[i].pid != 0) {
-      printf("[%d] (%d) ", jobs[i].jid, jobs[i].pid);
-      switch (jobs[i].state) {
-      case BG:
-        printf("Running ");
+/*
+ * runcached - Run the command of an expanded command line, w/ a cached
+ *    prefix, split into argc args & n NAME=value assigns. If the cache has
+ *    the result of an identical run (see cachekey), its output & exit
+ *    status are replayed without forking. Otherwise the command runs as
+ *    usual w/ its stdout & stderr captured in memfds, which are copied
+ *    out & saved when it's done, unless it was killed or stopped. Returns
+ *    the exit status, also saved in last_status.
+ */
+int runcached(char *expanded, int argc, char **argv, char **assigns,
+              int nassign, char **env) {
+  char key[2 * MAXARGBUF];
+  char path[2 * MAXLINE];
+  int keylen = cachekey(key, sizeof(key), argc, argv, assigns, nassign, env);
+
+  if (keylen < 0) // can't be cached, so just run it
+    FLOGINFO("cache key for %s is over %zu bytes, not caching", argv[0],
+             sizeof(key));
+  if (keylen < 0 || !cachedir())
+    return runcmd(expanded, argc, argv, assigns, nassign, env, 0);
+
+  unsigned long h = 14695981039346656037UL;
+  for (int i = 0; i < keylen; i++)
+    h = (h ^ (unsigned char)key[i]) * 1099511628211UL;
+  snprintf(path, sizeof(path), "%s/%016lx", cache.dir, h);
+
+  int status = cachereplay(path, key, keylen);
+  if (status >= 0) {
+    cache.hits++;
+    return last_status = status;
+  }
+  cache.misses++;
+
+  int outfd = memfd_create("tsh-cached-out", MFD_CLOEXEC);
+  int errfd = memfd_create("tsh-cached-err", MFD_CLOEXEC);
+  if (outfd < 0 || errfd < 0) {
+    fprintf(stderr, "Unable to capture command output: %s\n",
+            strerror(errno));
+    return last_status = 1;
+  }
+
+  // point stdout & stderr at the memfds while it runs, then put them back
+  fflush(stdout);
+  int savedout = dup(STDOUT_FILENO), savederr = dup(STDERR_FILENO);
+  dup2(outfd, STDOUT_FILENO);
+  dup2(errfd, STDERR_FILENO);
+  status = runcmd(expanded, argc, argv, assigns, nassign, env, 0);
+  fflush(stdout);
+  dup2(savedout, STDOUT_FILENO);
+  dup2(savederr, STDERR_FILENO);
+  close(savedout);
+  close(savederr);
+
+  copyfd(outfd, STDOUT_FILENO);
+  copyfd(errfd, STDERR_FILENO);
+  if (status < 128) // killed or stopped runs aren't repeatable
+    cachestore(path, key, keylen, status, outfd, errfd);
+  close(outfd);
+  close(errfd);
+  return last_status = status;
+}
+
+/*
+ * cachekey - Write the key identifying a cached run into dest (of given
+ *    size): its assigns & args, the device, inode, size & mtime of each
+ *    arg that's a regular file (the program included), the current
+ *    directory & a hash of the exported env. Returns its length, or -1 if
+ *    it doesn't fit.
+ */
+int cachekey(char *dest, size_t size, int argc, char **argv, char **assigns,
+             int nassign, char **env) {
+  size_t len = 0;
+  unsigned long envhash = 0;
+  char cwd[MAXLINE];
+  struct stat st;
+
+  for (int i = 0; i < nassign + argc && len < size; i++) {
+    char *arg = i < nassign ? assigns[i] : argv[i - nassign];
+    len += snprintf(dest + len, size - len, "%c:%s", i < nassign ? 'A' : 'a',
+                    arg) + 1;
+    if (i >= nassign && len < size && stat(arg, &st) == 0 &&
+        S_ISREG(st.st_mode))
+      len += snprintf(dest + len, size - len, "f:%lu:%lu:%lld:%ld.%09ld",
+                      (unsigned long)st.st_dev, (unsigned long)st.st_ino,
+                      (long long)st.st_size, (long)st.st_mtim.tv_sec,
+                      st.st_mtim.tv_nsec) + 1;
+  }
+
+  for (char **e = env; *e; e++) { // sum, as envp's order can vary
+    unsigned long h = 14695981039346656037UL;
+    for (char *c = *e; *c; c++)
+      h = (h ^ (unsigned char)*c) * 1099511628211UL;
+    envhash += h;
+  }
+  if (len < size)
+    len += snprintf(dest + len, size - len, "d:%s",
+                    getcwd(cwd, MAXLINE) ? cwd : "") + 1;
+  if (len < size)
+    len += snprintf(dest + len, size - len, "e:%016lx", envhash) + 1;
+  return len < size ? (int)len : -1;
+}
+
+/*
+ * cachedir - Get the cache directory, $TSH_CACHE_DIR or else
+ *    $HOME/.cache/tsh, creating it if needed. Its max size is
+ *    $TSH_CACHE_SIZE bytes, or else CACHESIZE. Returns NULL (after
+ *    alerting the user) if it can't be created.
+ */
+const char *cachedir(void) {
+  char *dir, *home, *max;
+
+  if (cache.dir[0])
+    return cache.dir;
+  if ((dir = getvar("TSH_CACHE_DIR", 13)))
+    snprintf(cache.dir, MAXLINE, "%s", dir);
+  else if ((home = getvar("HOME", 4)))
+    snprintf(cache.dir, MAXLINE, "%s/.cache/tsh", home);
+  else
+    snprintf(cache.dir, MAXLINE, "/tmp/tsh-cache-%d", (int)getuid());
+  max = getvar("TSH_CACHE_SIZE", 14);
+  cache.max = max ? atoll(max) : CACHESIZE;
+
+  for (char *c = cache.dir + 1;; c++) // like mkdir -p
+    if (*c == '/' || *c == '\0') {
+      char end = *c;
+      *c = '\0';
+      if (mkdir(cache.dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "cached: %s: %s\n", cache.dir, strerror(errno));
+        cache.dir[0] = '\0';
+        return NULL;
+      }
+      if (!(*c = end))
         break;
-      case FG:
-        printf("Foreground ");
+    }
+  return cache.dir;
+}
+
+/*
+ * cachereplay - If the cache file at path holds a result for key (of
+ *    length keylen), write its output to stdout & stderr, mark it as
+ *    recently used & return its exit status. Returns -1 on a miss. The
+ *    saved key is compared a buffer at a time, as keys can outgrow it.
+ */
+int cachereplay(const char *path, const char *key, size_t keylen) {
+  FILE *f = fopen(path, "r");
+  size_t flen, outlen, errlen;
+  char buf[8192];
+  int status;
+
+  if (!f)
+    return -1;
+  int hit = fscanf(f, "tsh-cache %d %zu %zu %zu", &status, &flen, &outlen,
+                   &errlen) == 4 &&
+            fgetc(f) == '\n' && flen == keylen;
+  for (size_t off = 0, n; hit && off < keylen; off += n) {
+    n = keylen - off < sizeof(buf) ? keylen - off : sizeof(buf);
+    hit = fread(buf, 1, n, f) == n && memcmp(buf, key + off, n) == 0;
+  }
+  if (!hit) {
+    fclose(f);
+    return -1;
+  }
+
+  fflush(stdout);
+  for (int fd = STDOUT_FILENO; fd <= STDERR_FILENO; fd++)
+    for (size_t left = fd == STDOUT_FILENO ? outlen : errlen; left > 0;) {
+      size_t n = fread(buf, 1, left < sizeof(buf) ? left : sizeof(buf), f);
+      if (n == 0)
         break;
-      case ST:
-        printf("Stopped ");
+      write(fd, buf, n);
+      left -= n;
+    }
+  fclose(f);
+
+  utimensat(AT_FDCWD, path, NULL, 0); // mtime is the LRU clock
+  FLOGINFO("cache hit: %s", path);
+  return status;
+}
+
+/*
+ * cachestore - Save a result to the cache file at path: key (of length
+ *    keylen), exit status & the output captured in outfd & errfd. Written
+ *    to a temp file & renamed, so readers never see part of a result.
+ *    Evicts the least recently used results if the cache is over size.
+ */
+void cachestore(const char *path, const char *key, size_t keylen, int status,
+                int outfd, int errfd) {
+  char tmp[2 * MAXLINE + 32];
+  struct stat out, err;
+
+  snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid());
+  int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0 || fstat(outfd, &out) < 0 || fstat(errfd, &err) < 0) {
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
+
+  dprintf(fd, "tsh-cache %d %zu %lld %lld\n", status, keylen,
+          (long long)out.st_size, (long long)err.st_size);
+  write(fd, key, keylen);
+  copyfd(outfd, fd);
+  copyfd(errfd, fd);
+  off_t size = lseek(fd, 0, SEEK_CUR);
+  close(fd);
+  if (rename(tmp, path) < 0) {
+    unlink(tmp);
+    return;
+  }
+
+  if (cache.bytes >= 0)
+    cache.bytes += size;
+  if (cache.bytes < 0 || cache.bytes > cache.max)
+    cacheevict();
+}
+
+/* copyfd - Copy the whole contents of fd to the current offset of to */
+void copyfd(int fd, int to) {
+  char buf[8192];
+  ssize_t n;
+
+  for (off_t off = 0; (n = pread(fd, buf, sizeof(buf), off)) > 0; off += n)
+    write(to, buf, n);
+}
+
+/* cmpmtime - Compare cache files by mtime, for qsort in cacheevict */
+int cmpmtime(const void *a, const void *b) {
+  const struct timespec *x = &((const struct cachefile_t *)a)->mtime;
+  const struct timespec *y = &((const struct cachefile_t *)b)->mtime;
+  if (x->tv_sec != y->tv_sec)
+    return x->tv_sec < y->tv_sec ? -1 : 1;
+  return (x->tv_nsec > y->tv_nsec) - (x->tv_nsec < y->tv_nsec);
+}
+
+/*
+ * cacheevict - Recount the bytes in the cache, then delete the least
+ *    recently used results until it's back under 90% of its max size.
+ */
+void cacheevict(void) {
+  DIR *d = opendir(cache.dir);
+  struct cachefile_t *files = NULL;
+  size_t n = 0, cap = 0;
+  struct dirent *ent;
+  struct stat st;
+
+  if (!d)
+    return;
+  cache.bytes = 0;
+  while ((ent = readdir(d))) {
+    if (ent->d_name[0] == '.' ||
+        fstatat(dirfd(d), ent->d_name, &st, 0) < 0 || !S_ISREG(st.st_mode))
+      continue;
+    if (n == cap) {
+      cap = cap ? cap * 2 : 64;
+      struct cachefile_t *grown = realloc(files, cap * sizeof(*files));
+      if (!grown)
         break;
-      default:
-        printf("listjobs: Internal error: job[%d].state=%d ", i, jobs[i].state);
-      }
-      printf("%s", jobs[i].cmdline);
+      files = grown;
     }
+    snprintf(files[n].name, sizeof(files[n].name), "%s", ent->d_name);
+    files[n].mtime = st.st_mtim;
+    files[n].size = st.st_size;
+    cache.bytes += st.st_size;
+    n++;
+  }
+
+  if (cache.bytes > cache.max) {
+    qsort(files, n, sizeof(*files), cmpmtime);
+    for (size_t i = 0; i < n && cache.bytes > cache.max / 10 * 9; i++)
+      if (unlinkat(dirfd(d), files[i].name, 0) == 0) {
+        cache.bytes -= files[i].size;
+        cache.evictions++;
+      }
   }
+  closedir(d);
+  free(files);
 }
-/******************************
- * end job list helper routines
- ******************************/
+
+/* cachestats - Print the cache's hit rate & size, for a bare cached */
+void cachestats(void) {
+  unsigned long runs = cache.hits + cache.misses;
+
+  if (!cachedir())
+    return;
+  if (cache.bytes < 0)
+    cacheevict();
+  printf("cache %s: %lu hits, %lu misses, %.1f%% hit rate\n", cache.dir,
+         cache.hits, cache.misses, runs ? 100.0 * cache.hits / runs : 0.0);
+  printf("%lld of %lld bytes used, %lu evictions\n", cache.bytes, cache.max,
+         cache.evictions);
+}
+
+/*****************************************
+ * Helper routines for time & bench
+ *****************************************/
+
+/*
+ * runtimed - Run the command of an expanded command line (w/o its time
+ *    prefix) as runcmd does, then print its real, user & sys times to
+ *    stderr. CPU times include tsh's own, for builtins. Returns the
+ *    command's exit status.
+ */
+int runtimed(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env) {
+  struct timespec start, end;
+  double user0, sys0, user, sys;
+
+  cputimes(&user0, &sys0);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int status = runcmd(expanded, argc, argv, assigns, nassign, env, 0);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  cputimes(&user, &sys);
+
+  fflush(stdout); // command's output first
+  fprintf(stderr, "real %.3fs  user %.3fs  sys %.3fs\n",
+          (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9,
+          user - user0, sys - sys0);
+  return last_status = status;
+}
+
+/*
+ * runbench - Run the bench builtin, bench [-n N] [-w W] cmd args..., which
+ *    runs cmd W times to warm up, then N (default 10) times more, each as
+ *    a fg job (or builtin) w/ its stdout discarded, & reports stats of the
+ *    timed runs' wall times: mean & standard deviation, min, median, p95,
+ *    p99 & max, & outliers (beyond 1.5 IQRs of the quartiles). Returns 0,
+ *    or 1 if any run failed.
+ */
+int runbench(char *expanded, int argc, char **argv, char **assigns,
+             int nassign, char **env) {
+  int nruns = 10, nwarm = 0, failed = 0, i = 1, n = 0;
+  char *endptr;
+
+  for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+    long val = strtol(argv[i + 1], &endptr, 10);
+    if (*endptr != '\0' || val < 0 || val > 1000000)
+      break;
+    if (strcmp(argv[i], "-n") == 0 && val > 0)
+      nruns = val;
+    else if (strcmp(argv[i], "-w") == 0)
+      nwarm = val;
+    else
+      break;
+  }
+  if (i >= argc || argv[i][0] == '-') {
+    fprintf(stderr, "usage: bench [-n N] [-w warmup] cmd args...\n");
+    return last_status = 1;
+  }
+  argc -= i;
+  argv += i;
+
+  double *secs = malloc(nruns * sizeof(double)); // wall time of each run
+  if (!secs) {
+    fprintf(stderr, "bench: %s\n", strerror(errno));
+    return last_status = 1;
+  }
+  double user0, sys0, user, sys;
+
+  fflush(stdout); // runs' output goes to /dev/null, tsh's included
+  int out = dup(STDOUT_FILENO), null = open("/dev/null", O_WRONLY);
+  if (out >= 0 && null >= 0)
+    dup2(null, STDOUT_FILENO);
+  if (null >= 0)
+    close(null);
+
+  for (int j = 0; j < nwarm && !interrupted; j++)
+    runcmd(expanded, argc, argv, assigns, nassign, env, 0);
+  cputimes(&user0, &sys0);
+  while (n < nruns && !interrupted) {
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    failed |= runcmd(expanded, argc, argv, assigns, nassign, env, 0) != 0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    secs[n++] =
+        (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+  }
+  cputimes(&user, &sys);
+
+  fflush(stdout);
+  if (out >= 0) {
+    dup2(out, STDOUT_FILENO);
+    close(out);
+  }
+  if (n == 0) {
+    free(secs);
+    return last_status = 1;
+  }
+
+  double mean = 0, var = 0;
+  for (int j = 0; j < n; j++)
+    mean += secs[j] / n;
+  for (int j = 0; j < n; j++)
+    var += (secs[j] - mean) * (secs[j] - mean) / (n > 1 ? n - 1 : 1);
+  qsort(secs, n, sizeof(double), cmpdouble);
+  double q1 = secs[n / 4], q3 = secs[(3 * n) / 4], iqr = q3 - q1;
+  int outliers = 0;
+  for (int j = 0; j < n; j++)
+    outliers += secs[j] < q1 - 1.5 * iqr || secs[j] > q3 + 1.5 * iqr;
+
+  printf("bench: %d runs of %s", n, argv[0]);
+  for (int j = 1; j < argc; j++)
+    printf(" %s", argv[j]);
+  printf(" (%d warmup)%s\n", nwarm, failed ? ", some failed" : "");
+  char b[5][16];
+  printf("  mean %s +- %s  user %s  sys %s\n", fmtsecs(mean, b[0]),
+         fmtsecs(sqrt(var), b[1]), fmtsecs((user - user0) / n, b[2]),
+         fmtsecs((sys - sys0) / n, b[3]));
+  printf("  min %s  median %s  p95 %s  p99 %s  max %s\n", fmtsecs(secs[0], b[0]),
+         fmtsecs(secs[n / 2], b[1]), fmtsecs(secs[(int)(n * 0.95)], b[2]),
+         fmtsecs(secs[(int)(n * 0.99)], b[3]), fmtsecs(secs[n - 1], b[4]));
+  printf("  outliers %d (%.1f%%)\n", outliers, 100.0 * outliers / n);
+
+  free(secs);
+  return last_status = failed;
+}
+
+/*
+ * cputimes - Get the user & sys CPU secs used so far by tsh & the
+ *    children it has reaped
+ */
+void cputimes(double *user, double *sys) {
+  struct rusage self, kids;
+
+  getrusage(RUSAGE_SELF, &self);
+  getrusage(RUSAGE_CHILDREN, &kids);
+  *user = self.ru_utime.tv_sec + kids.ru_utime.tv_sec +
+          (self.ru_utime.tv_usec + kids.ru_utime.tv_usec) / 1e6;
+  *sys = self.ru_stime.tv_sec + kids.ru_stime.tv_sec +
+         (self.ru_stime.tv_usec + kids.ru_stime.tv_usec) / 1e6;
+}
+
+/*
+ * fmtsecs - Format secs into buf (of 16 chars) in us, ms or s, whichever
+ *    suits, returning buf
+ */
+char *fmtsecs(double secs, char *buf) {
+  if (secs < 1e-3)
+    snprintf(buf, 16, "%.1fus", secs * 1e6);
+  else if (secs < 1)
+    snprintf(buf, 16, "%.3fms", secs * 1e3);
+  else
+    snprintf(buf, 16, "%.3fs", secs);
+  return buf;
+}
+
+/* cmpdouble - qsort comparator, for doubles in ascending order */
+int cmpdouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+/*****************************************
+ * Helper routines for the latency stats
+ *****************************************/
+
+/*
+ * initstats - Map the latency histograms. They're in shared memory, so
+ *    forked children can record their fork to exec time too.
+ */
+void initstats(void) {
+  size_t size = NHISTS * sizeof(struct hist_t);
+
+  hists = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+               -1, 0);
+  if (hists == MAP_FAILED) { // children's times are lost, but tsh's aren't
+    LOGWARN("unable to map shared stats");
+    hists = calloc(NHISTS, sizeof(struct hist_t));
+  }
+}
+
+/*
+ * nowns - Get the raw monotonic clock in ns. Unlike CLOCK_MONOTONIC, it
+ *    isn't slewed by NTP, so short intervals are measured exactly.
+ */
+unsigned long nowns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  return now.tv_sec * 1000000000UL + now.tv_nsec;
+}
+
+/*
+ * histadd - Record v in histogram h. Async-signal-safe, & atomic, as
+ *    children record into the same histograms.
+ */
+void histadd(int h, unsigned long v) {
+  if (!hists)
+    return;
+  __atomic_fetch_add(&hists[h].count, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hists[h].sum, v, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&hists[h].buckets[histindex(v)], 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * histindex - Get the bucket for v: values under 2^HISTSUB get a bucket
+ *    each, & each larger power of 2 is split into 2^HISTSUB equal buckets,
+ *    so a bucket's width is within 1/2^HISTSUB of its values
+ */
+unsigned histindex(unsigned long v) {
+  if (v < (1UL << HISTSUB))
+    return v;
+  int e = 63 - __builtin_clzl(v); // v's power of 2
+  return ((e - HISTSUB + 1) << HISTSUB) +
+         ((v >> (e - HISTSUB)) & ((1 << HISTSUB) - 1));
+}
+
+/* histvalue - Get the middle of bucket idx's values, see histindex */
+unsigned long histvalue(unsigned idx) {
+  if (idx < (1U << HISTSUB))
+    return idx;
+  int shift = (idx >> HISTSUB) - 1; // log2 of the bucket's width
+  unsigned long low = ((1UL << HISTSUB) + (idx & ((1 << HISTSUB) - 1)))
+                      << shift;
+  return low + (1UL << shift) / 2;
+}
+
+/* histpct - Get the value at percentile pct of hist */
+unsigned long histpct(struct hist_t *hist, double pct) {
+  unsigned long rank = ceil(hist->count * pct / 100), seen = 0;
+
+  if (rank == 0)
+    rank = 1;
+  for (unsigned i = 0; i < HISTBUCKETS; i++)
+    if ((seen += hist->buckets[i]) >= rank)
+      return histvalue(i);
+  return 0;
+}
+
+/*
+ * phase - In verbose mode, record that the current command spent from t0
+ *    until now in phase p. Async-signal-safe.
+ */
+void phase(int p, unsigned long t0) {
+  if (!verbose)
+    return;
+  phases.ns[p] = nowns() - t0;
+  phases.set |= 1U << p;
+}
+
+/*
+ * printphases - Log how long command cmd spent in each phase timed, then
+ *    start over for the next command
+ */
+void printphases(const char *cmd) {
+  static const char *names[NPHASES] = {"read", "parse",  "builtin", "block",
+                                       "fork", "addjob", "waitfg",  "reap"};
+  char line[MAXLINE], buf[16];
+  size_t len = 0;
+
+  for (int p = 0; p < NPHASES; p++)
+    if (phases.set & (1U << p))
+      len += snprintf(line + len, sizeof(line) - len, " %s %s", names[p],
+                      fmtsecs(phases.ns[p] / 1e9, buf));
+  line[len] = '\0';
+  phases.set = 0;
+  FLOGINFO("%s: phases:%s", cmd, line);
+}
+
+/*
+ * do_stats - Execute the builtin stats command, stats [-r], which prints
+ *    the count, mean, percentiles & max of each of tsh's latency
+ *    histograms, or w/ -r resets them
+ */
+void do_stats(int argc, char **argv) {
+  static const char *names[NHISTS] = {"parse", "lookup", "fork",   "exec",
+                                      "wakeup", "reap",  "reaped", "forward"};
+  static const double pcts[] = {50, 90, 99, 99.9, 100};
+
+  if (argc == 2 && strcmp(argv[1], "-r") == 0) {
+    memset(hists, 0, NHISTS * sizeof(struct hist_t));
+    return;
+  }
+  if (argc != 1) {
+    fprintf(stderr, "usage: stats [-r]\n");
+    last_status = 1;
+    return;
+  }
+
+  printf("%-8s %8s %10s %10s %10s %10s %10s %10s\n", "path", "count", "mean",
+         "p50", "p90", "p99", "p99.9", "max");
+  for (int h = 0; h < NHISTS; h++) {
+    struct hist_t *hist = &hists[h];
+    char buf[16];
+
+    if (!hist->count)
+      continue;
+    printf("%-8s %8lu", names[h], hist->count);
+    if (h == H_BATCH) // a count, not a time
+      printf(" %10.1f", (double)hist->sum / hist->count);
+    else
+      printf(" %10s", fmtsecs((double)hist->sum / hist->count / 1e9, buf));
+    for (size_t i = 0; i < sizeof(pcts) / sizeof(pcts[0]); i++)
+      if (h == H_BATCH)
+        printf(" %10lu", histpct(hist, pcts[i]));
+      else
+        printf(" %10s", fmtsecs(histpct(hist, pcts[i]) / 1e9, buf));
+    printf("\n");
+  }
+}
+
+#ifdef EVLOG
+/*****************************************
+ * Helper routines for the event log
+ *****************************************/
+
+/*
+ * evlog - Record an event from call site site w/ args matching its
+ *    format, into the next slot of the event ring. Lock free &
+ *    async-signal-safe: a handler interrupting evlog just takes the slot
+ *    after. Strings are copied, truncated to fit the event.
+ */
+void evlog(const struct evsite_def_t *site, ...) {
+  unsigned long i = __atomic_fetch_add(&evring.next, 1, __ATOMIC_RELAXED);
+  struct evrec_t *rec = &evring.recs[i & (EVRING - 1)];
+  size_t used = 0;
+  int n = 0;
+  va_list ap;
+
+  rec->ns = nowns();
+  rec->site = site - __start_evlog_sites;
+  rec->pid = getpid();
+  va_start(ap, site);
+  for (const char *c = site->fmt; *c && n < EVARGS; c++) {
+    if (*c != '%' || *++c == '%')
+      continue;
+    int lng = 0;
+    while (*c && strchr("-+ #0123456789.", *c))
+      c++;
+    for (; *c == 'l' || *c == 'z'; c++)
+      lng = 1;
+    if (*c == 's') { // copy what fits, & store its offset
+      const char *str = va_arg(ap, const char *);
+      if (!str) // as printf shows it
+        str = "(null)";
+      size_t len = strnlen(str, EVSTR - 1 - used); // used < EVSTR always
+      memcpy(rec->str + used, str, len);
+      rec->str[used + len] = '\0';
+      rec->args[n++] = used;
+      used = used + len + 1 < EVSTR ? used + len + 1 : EVSTR - 1;
+    } else if (lng)
+      rec->args[n++] = va_arg(ap, unsigned long);
+    else
+      rec->args[n++] = va_arg(ap, unsigned);
+  }
+  va_end(ap);
+}
+
+/*
+ * evdump - At exit, write the event log to $TSH_EVLOG (default
+ *    tsh-PID.evlog) for evdecode, see evlog.h. Only tsh itself does so,
+ *    not children exiting w/o exec.
+ */
+void evdump(void) {
+  char path[64];
+  const char *dest = getenv("TSH_EVLOG");
+  unsigned long first = evring.next > EVRING ? evring.next - EVRING : 0;
+  struct evhdr_t hdr = {EVMAGIC, __stop_evlog_sites - __start_evlog_sites,
+                        evring.next - first};
+
+  if (getpid() != evowner)
+    return;
+  if (!dest) {
+    snprintf(path, sizeof(path), "tsh-%d.evlog", evowner);
+    dest = path;
+  }
+  FILE *f = fopen(dest, "wb");
+  if (!f) {
+    fprintf(stderr, "evlog: %s: %s\n", dest, strerror(errno));
+    return;
+  }
+
+  fwrite(&hdr, sizeof(hdr), 1, f);
+  for (struct evsite_def_t *d = __start_evlog_sites; d < __stop_evlog_sites;
+       d++) {
+    struct evsite_t site = {d->line, strlen(d->prefix), strlen(d->file),
+                            strlen(d->fmt)};
+    fwrite(&site, sizeof(site), 1, f);
+    fputs(d->prefix, f);
+    fputs(d->file, f);
+    fputs(d->fmt, f);
+  }
+  for (unsigned long i = first; i < evring.next; i++)
+    fwrite(&evring.recs[i & (EVRING - 1)], sizeof(struct evrec_t), 1, f);
+  fclose(f);
+}
+#endif
 
 /***********************
  * Other helper routines
@@ -730,10 +5320,16 @@ void listjobs(struct job_t *jobs) {
  * usage - print a help message
  */
 void usage(void) {
-  printf("Usage: shell [-hvp]\n");
+  printf("Usage: shell [-hvp] [-c command] [-j N] [-m manifest [-r N] "
+         "[-o report]]\n");
   printf("   -h   print this message\n");
   printf("   -v   print additional diagnostic information\n");
   printf("   -p   do not emit a command prompt\n");
+  printf("   -c   run command list & exit with its status\n");
+  printf("   -j   run at most N jobs at once, queueing more bg jobs\n");
+  printf("   -m   run each line of manifest as a bg job, then exit at EOF\n");
+  printf("   -r   retry failed manifest entries N times (default 2)\n");
+  printf("   -o   write the manifest report here (default <manifest>.jsonl)\n");
   exit(1);
 }
 